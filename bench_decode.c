@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "operation.h"
+
+#define PLATTERS_COUNT (1 << 20)
+#define ROUNDS 200
+
+/**
+ * The bitfield layout operation.h used to decode into,
+ * kept here as the baseline.
+ */
+
+typedef struct StandardOperation {
+	uint8_t number: 4;
+	uint32_t      : 17;
+	uint8_t a     : 3;
+	uint8_t b     : 3;
+	uint8_t c     : 3;
+} StandardOperation;
+
+typedef struct PutOperation {
+	uint8_t number: 4;
+	uint8_t a     : 3;
+	uint32_t value: 25;
+} PutOperation;
+
+typedef union Operation {
+	StandardOperation standard;
+	PutOperation put;
+} Operation;
+
+static void int_to_operation(uint32_t value, Operation* operation)
+{
+	operation->standard.number = (value >> 28) & 0xF;
+
+	if (operation->standard.number < 13)
+	{
+		operation->standard.a = (value >> 6) & 7;
+		operation->standard.b = (value >> 3) & 7;
+		operation->standard.c = (value) & 7;
+	}
+	else
+	{
+		operation->put.a = (value >> 25) & 7;
+		operation->put.value = value & 0x1FFFFFF;
+	}
+}
+
+static double now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void report(const char* name, double elapsed, uint32_t checksum)
+{
+	double rate = (double)PLATTERS_COUNT * ROUNDS / elapsed / 1e6;
+	printf("%-10s %8.1f Mplatters/s (checksum %08x)\n", name, rate, checksum);
+}
+
+/**
+ * Decodes the same random platters with the bitfield union
+ * and with the accessors, folding every field into a
+ * checksum so that neither can be optimized away.
+ */
+
+int main(void)
+{
+	uint32_t* platters = (uint32_t*)malloc(PLATTERS_COUNT * sizeof(uint32_t));
+
+	if (platters == NULL)
+		return 1;
+
+	srand(42);
+
+	uint32_t i;
+	for (i = 0; i < PLATTERS_COUNT; i++)
+		platters[i] = ((uint32_t)(rand() % 14) << 28) | ((uint32_t)rand() & 0x0FFFFFFF);
+
+	uint32_t checksum = 0;
+	double start = now();
+
+	int round;
+	for (round = 0; round < ROUNDS; round++)
+	{
+		Operation op;
+
+		for (i = 0; i < PLATTERS_COUNT; i++)
+		{
+			int_to_operation(platters[i], &op);
+
+			if (op.standard.number == 13)
+				checksum += op.put.a ^ op.put.value;
+			else
+				checksum += op.standard.a ^ (op.standard.b << 3) ^ (op.standard.c << 6);
+		}
+	}
+
+	report("bitfields", now() - start, checksum);
+
+	checksum = 0;
+	start = now();
+
+	for (round = 0; round < ROUNDS; round++)
+	{
+		for (i = 0; i < PLATTERS_COUNT; i++)
+		{
+			uint32_t op = platters[i];
+
+			if (operation_number(op) == OPERATION_ORTHOGRAPHY)
+				checksum += put_register(op) ^ put_value(op);
+			else
+				checksum += operation_a(op) ^ (operation_b(op) << 3) ^ (operation_c(op) << 6);
+		}
+	}
+
+	report("accessors", now() - start, checksum);
+
+	free(platters);
+	return 0;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "codecache.h"
+
+#define HASH_LANES 4
+#define HASH_PRIME 0x9E3779B97F4A7C15ULL
+
+static void entry_filename(char* filename, size_t size, const char* directory, uint64_t hash)
+{
+	snprintf(filename, size, "%s/um-%016llx.code", directory, (unsigned long long)hash);
+}
+
+/**
+ * Hashes the program image eight bytes at a time over four
+ * independent lanes, so that it costs about as much as
+ * reading it. Not meant to resist crafted collisions.
+ */
+
+uint64_t code_hash(const uint8_t* bytes, size_t size)
+{
+	uint64_t lanes[HASH_LANES] = { 1, 2, 3, 4 };
+	uint64_t word;
+	size_t i = 0;
+	int lane;
+
+	for (; i + HASH_LANES * sizeof(uint64_t) <= size; i += HASH_LANES * sizeof(uint64_t))
+	{
+		for (lane = 0; lane < HASH_LANES; lane++)
+		{
+			memcpy(&word, bytes + i + lane * sizeof(uint64_t), sizeof(uint64_t));
+			lanes[lane] = (lanes[lane] ^ word) * HASH_PRIME;
+			lanes[lane] ^= lanes[lane] >> 29;
+		}
+	}
+
+	uint64_t hash = size;
+
+	for (; i < size; i++)
+		hash = (hash ^ bytes[i]) * HASH_PRIME;
+
+	for (lane = 0; lane < HASH_LANES; lane++)
+	{
+		hash = (hash ^ lanes[lane]) * HASH_PRIME;
+		hash ^= hash >> 32;
+	}
+
+	return hash;
+}
+
+/**
+ * Maps the decoded program stored for hash, privately so
+ * that a program modifying itself only copies the pages
+ * it writes. Returns NULL when there's no usable entry.
+ * Only entries owned by the user are trusted, since their
+ * handler indices are used as they are.
+ */
+
+Instruction* code_cache_map(const char* directory, uint64_t hash, uint32_t count, size_t* mapped)
+{
+	char filename[PATH_MAX];
+	entry_filename(filename, sizeof(filename), directory, hash);
+
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	struct stat info;
+	size_t size = sizeof(CodeCacheHeader) + (size_t)count * sizeof(Instruction);
+
+	if (fstat(fd, &info) != 0 || info.st_uid != geteuid() || (size_t)info.st_size != size)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t* map = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	CodeCacheHeader* header = (CodeCacheHeader*)map;
+
+	if (memcmp(header->magic, CODE_CACHE_MAGIC, 4) != 0 || header->version != CODE_CACHE_VERSION
+		|| header->handlers != HANDLERS_COUNT || header->count != count || header->hash != hash)
+	{
+		munmap(map, size);
+		return NULL;
+	}
+
+	*mapped = size;
+
+	return (Instruction*)(map + sizeof(CodeCacheHeader));
+}
+
+/**
+ * Writes the entry for hash under a temporary name and
+ * renames it, so that concurrent readers never map a
+ * partial entry. Failing to store is not an error, the
+ * program is decoded again next time.
+ */
+
+void code_cache_store(const char* directory, uint64_t hash, const Instruction* code, uint32_t count)
+{
+	char filename[PATH_MAX];
+	char temporary[PATH_MAX];
+
+	entry_filename(filename, sizeof(filename), directory, hash);
+	snprintf(temporary, sizeof(temporary), "%s.%d", filename, (int)getpid());
+
+	int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if (fd < 0)
+	{
+		fprintf(stderr, "WARNING: Can't write the code cache entry %s\n", temporary);
+		return;
+	}
+
+	FILE* out = fdopen(fd, "wb");
+
+	if (out == NULL)
+	{
+		fprintf(stderr, "WARNING: Can't write the code cache entry %s\n", temporary);
+		close(fd);
+		unlink(temporary);
+		return;
+	}
+
+	CodeCacheHeader header;
+	memset(&header, 0, sizeof(CodeCacheHeader));
+	memcpy(header.magic, CODE_CACHE_MAGIC, 4);
+	header.version = CODE_CACHE_VERSION;
+	header.handlers = HANDLERS_COUNT;
+	header.count = count;
+	header.hash = hash;
+
+	fwrite(&header, sizeof(CodeCacheHeader), 1, out);
+	fwrite(code, sizeof(Instruction), count, out);
+
+	if (ferror(out) | fclose(out) || rename(temporary, filename) != 0)
+	{
+		fprintf(stderr, "WARNING: Can't write the code cache entry %s\n", filename);
+		unlink(temporary);
+	}
+}
+
+void code_cache_unmap(Instruction* code, size_t mapped)
+{
+	munmap((uint8_t*)code - sizeof(CodeCacheHeader), mapped);
+}
@@ -0,0 +1,32 @@
+#if !defined(__CODECACHE_H)
+#define __CODECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "machine.h"
+
+#define CODE_CACHE_MAGIC "UMCC"
+#define CODE_CACHE_VERSION 1
+
+/**
+ * A cache entry is this header followed by the decoded
+ * instructions, in a file named after the hash of the
+ * program image. Entries written by a build with another
+ * set of handlers are ignored.
+ */
+
+typedef struct CodeCacheHeader {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	handlers;
+	uint32_t	count;
+	uint64_t	hash;
+} CodeCacheHeader;
+
+uint64_t code_hash(const uint8_t* bytes, size_t size);
+Instruction* code_cache_map(const char* directory, uint64_t hash, uint32_t count, size_t* mapped);
+void code_cache_store(const char* directory, uint64_t hash, const Instruction* code, uint32_t count);
+void code_cache_unmap(Instruction* code, size_t mapped);
+
+#endif /* __CODECACHE_H */
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Runs a program on every configuration of the machine, for
+# at most limit seconds each, and reports the instructions
+# per second they averaged, as published by um -s.
+#
+# Usage: ./compare_builds.sh [-t limit] [program [build...]]
+
+limit=60
+
+usage()
+{
+	echo "Usage: $0 [-t limit] [program [build...]]" >&2
+	exit 2
+}
+
+while getopts t: option
+do
+	case $option in
+		t) limit=$OPTARG ;;
+		*) usage ;;
+	esac
+done
+
+shift $((OPTIND - 1))
+
+program=${1:-sandmark.umz}
+[ $# -gt 0 ] && shift
+builds=${*:-um-safe um-fast um-debug um-lto um-pgo}
+
+if [ ! -x ./umstat ]
+then
+	echo "FATAL: umstat is not built" >&2
+	exit 1
+fi
+
+stats=$(mktemp)
+trap 'rm -f "$stats"' EXIT
+
+printf "%-16s %16s %10s %16s\n" build cycles seconds "instructions/s"
+
+for build in $builds
+do
+	if [ ! -x "./$build" ]
+	then
+		echo "ERROR: $build is not built, skipping it" >&2
+		continue
+	fi
+
+	# A machine stopped by the limit still publishes its
+	# counters when it exits
+
+	rm -f "$stats"
+	timeout "$limit" "./$build" -s "$stats" "$program" < /dev/null > /dev/null 2>&1
+
+	./umstat -n 1 "$stats" | awk -v build="$build" 'NR == 2 {
+		printf "%-16s %16s %10.1f %16.0f\n", build, $2, $1, ($1 > 0 ? $2 / $1 : 0)
+	}'
+done
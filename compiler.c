@@ -2,34 +2,124 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
 
 #define ERR_MISSING_ARGUMENTS 2
 #define ERR_INVALID_INPUT_FILE 3
 #define ERR_INVALID_OUTPUT_FILE 4
 #define ERR_COMPILATION_FAILED 5
+#define ERR_OUT_OF_MEMORY 6
 
 #define INVALID_OPERATION_CODE 255
 
+#define MAX_TOKENS 16
+#define MAX_PUT_VALUE 0x1FFFFFF // 25 bits
+#define MAX_CONSTANT_SEQUENCE 6
+#define NO_REGISTER 255
+
+#define SECTION_TEXT 0
+#define SECTION_DATA 1
+#define SECTIONS_COUNT 2
+
+#define PSEUDO_LI 100
+#define PSEUDO_JMP 101
+
 #include "operation.h"
 
+/**
+ * A single platter of the output image. Instructions
+ * keep their decoded form until the link step so that
+ * later passes can still reason about them, data words
+ * are kept as raw values. When symbol is set the value
+ * of the symbol is added to the put immediate (or to
+ * the word) once every address is known.
+ */
+
+typedef struct Item {
+	uint32_t	platter;
+	uint32_t	word;
+	char*		symbol;
+	uint8_t		is_word;
+	uint8_t		removed;
+	size_t		line;
+} Item;
+
+typedef struct Section {
+	Item*		items;
+	size_t		size;
+	size_t		capacity;
+} Section;
+
+typedef struct Label {
+	char*		name;
+	uint8_t		section;
+	size_t		index;
+	size_t		line;
+} Label;
+
+typedef struct Program {
+	Section		sections[SECTIONS_COUNT];
+	Label*		labels;
+	size_t		labels_count;
+	size_t		labels_capacity;
+	uint8_t		current_section;
+} Program;
+
 int is_empty_line(const char* line, size_t length);
-void parse_line(const char* line, size_t line_count, Operation* op);
+size_t tokenize(char* line, char** tokens, size_t line_count);
+void parse_line(char* line, size_t line_count, Program* program);
 uint8_t get_operation_code(const char* code);
+uint8_t parse_register(const char* token, size_t line_count);
+int parse_value(const char* token, size_t line_count, uint32_t* value, char** symbol);
+int is_symbol_name(const char* token);
+
+void* grow_array(void* array, size_t* capacity, size_t size, size_t element_size);
+Item* append_item(Program* program, size_t line_count);
+Item* append_operation(Program* program, uint32_t platter, size_t line_count);
+void define_label(Program* program, const char* name, size_t line_count);
+Label* find_label(Program* program, const char* name);
+uint32_t label_address(Program* program, Label* label);
+
+size_t constant_sequence(uint8_t a, uint32_t value, uint8_t scratch, uint32_t* sequence);
+size_t optimize_program(Program* program);
+int is_block_boundary(Item* items, const uint8_t* labelled, size_t index);
+size_t propagate_constants(Item* items, size_t start, size_t end);
+size_t eliminate_dead_stores(Item* items, size_t start, size_t end);
+void compact_section(Program* program, uint8_t s);
+void link_program(Program* program, FILE* output_file);
+void write_platter(uint32_t value, FILE* output_file);
 
 int main(int argc, char *argv[])
 {
-	if (argc < 2)
+	int optimize = 0;
+	int option;
+
+	while ((option = getopt(argc, argv, "O")) != -1)
 	{
-		fprintf(stderr, "Usage: %s program [outfile]\n", argv[0]);
+		if (option == 'O')
+		{
+			optimize = 1;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-O] program [outfile]\n", argv[0]);
+			exit(ERR_MISSING_ARGUMENTS);
+		}
+	}
+
+	if (argc - optind < 1)
+	{
+		fprintf(stderr, "Usage: %s [-O] program [outfile]\n", argv[0]);
 		exit(ERR_MISSING_ARGUMENTS);
 	}
 
-	char* input_filename = argv[1];
+	char* input_filename = argv[optind];
 	char* output_filename = "output.umz";
 
-	if (argc > 2)
-		output_filename =  argv[2];
+	if (argc - optind > 1)
+		output_filename =  argv[optind + 1];
 
 	FILE* input_file = fopen(input_filename, "r");
 
@@ -39,25 +129,19 @@ int main(int argc, char *argv[])
 		exit(ERR_INVALID_INPUT_FILE);
 	}
 
-	FILE* output_file = fopen(output_filename, "wb");
-
-	if (output_file == NULL)
-	{
-		fprintf(stderr, "FATAL: Can't open output file: %s\n", output_filename);
-		exit(ERR_INVALID_OUTPUT_FILE);
-	}
+	Program program;
+	memset(&program, 0, sizeof(Program));
 
 	char* current_line = NULL;
 	size_t length = 0;
 	size_t line_count = 1;
-	Operation op;
-	uint32_t value;
+
+	// First pass: parse every line, expand pseudo operations
+	// and record where each label points.
 
 	while(getline(&current_line, &length, input_file) != -1)
 	{
-		parse_line(current_line, line_count++, &op);
-		value = operation_to_int(&op);
-		fwrite(&value, sizeof(uint32_t), 1, output_file);
+		parse_line(current_line, line_count++, &program);
 
 		free(current_line);
 		current_line = NULL;
@@ -70,6 +154,27 @@ int main(int argc, char *argv[])
 	}
 
 	fclose(input_file);
+
+	if (optimize)
+	{
+		size_t before = program.sections[SECTION_TEXT].size;
+		size_t removed = optimize_program(&program);
+
+		printf("Optimizer removed %zu instructions (%zu -> %zu)\n", removed, before, program.sections[SECTION_TEXT].size);
+	}
+
+	FILE* output_file = fopen(output_filename, "wb");
+
+	if (output_file == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't open output file: %s\n", output_filename);
+		exit(ERR_INVALID_OUTPUT_FILE);
+	}
+
+	// Second pass: lay out the sections, resolve symbols and emit
+
+	link_program(&program, output_file);
+
 	fclose(output_file);
 }
 
@@ -85,11 +190,72 @@ int is_empty_line(const char* line, size_t length)
 	return 1;
 }
 
-void parse_line(const char* line, size_t line_count, Operation* op)
+/**
+ * Splits a line in place on whitespace and commas, stopping
+ * at the first comment character ('#' or ';'). Character
+ * literals are kept whole so that ' ' and '#' can be used.
+ */
+
+size_t tokenize(char* line, char** tokens, size_t line_count)
 {
-	if (op == NULL)
-		return;
+	size_t count = 0;
+	char* p = line;
+
+	while (*p)
+	{
+		while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r' || *p == '\n')
+			p++;
+
+		if (*p == '\0' || *p == '#' || *p == ';')
+			break;
+
+		if (count == MAX_TOKENS)
+		{
+			fprintf(stderr, "COMPILATION ERROR: Too many tokens at line %zu\n", line_count);
+			exit(ERR_COMPILATION_FAILED);
+		}
 
+		tokens[count++] = p;
+
+		if (*p == '\'')
+		{
+			p++;
+
+			if (*p == '\\' && *(p + 1))
+				p++;
+
+			if (*p)
+				p++;
+
+			if (*p != '\'')
+			{
+				fprintf(stderr, "COMPILATION ERROR: Unterminated character literal at line %zu\n", line_count);
+				exit(ERR_COMPILATION_FAILED);
+			}
+
+			p++;
+		}
+		else
+		{
+			while (*p && *p != ' ' && *p != '\t' && *p != ',' && *p != '\r' && *p != '\n' && *p != '#' && *p != ';')
+				p++;
+		}
+
+		if (*p == '#' || *p == ';')
+		{
+			*p = '\0';
+			break;
+		}
+
+		if (*p)
+			*p++ = '\0';
+	}
+
+	return count;
+}
+
+void parse_line(char* line, size_t line_count, Program* program)
+{
 	size_t length = strlen(line);
 
 	if (length <= 0)
@@ -101,119 +267,868 @@ void parse_line(const char* line, size_t line_count, Operation* op)
 	if (is_empty_line(line, length))
 		return;
 
-	char* ac = NULL;
-	char* bc = NULL;
-	char* cc = NULL;
+	char* tokens[MAX_TOKENS];
+	size_t count = tokenize(line, tokens, line_count);
+	size_t first = 0;
 
-	char* token = strtok((char*)line, " \n");
-	char* number_end = NULL;
+	// Any number of labels can precede the operation
+
+	while (first < count && tokens[first][strlen(tokens[first]) - 1] == ':')
+	{
+		tokens[first][strlen(tokens[first]) - 1] = '\0';
+		define_label(program, tokens[first], line_count);
+		first++;
+	}
 
-	uint8_t code_number = INVALID_OPERATION_CODE;
+	if (first == count)
+		return;
 
-	while (token != NULL)
+	char* code = tokens[first];
+	char** args = &tokens[first + 1];
+	size_t args_count = count - first - 1;
+
+	if (code[0] == '.')
 	{
-		if (strlen(token))
+		if (strcmp(code, ".text") == 0)
 		{
-			if (code_number == INVALID_OPERATION_CODE)
-			{
-				code_number = get_operation_code(token);
-
-				if (code_number == INVALID_OPERATION_CODE)
-				{
-					fprintf(stderr, "COMPILATION ERROR: Invalid operation '%s' found at line %zu\n", token, line_count);
-					exit(ERR_COMPILATION_FAILED);
-				}
-			}
-			else if (ac == NULL)
-			{
-				ac = token;
-			}
-			else if (bc == NULL)
+			program->current_section = SECTION_TEXT;
+		}
+		else if (strcmp(code, ".data") == 0)
+		{
+			program->current_section = SECTION_DATA;
+		}
+		else if (strcmp(code, ".word") == 0)
+		{
+			if (args_count == 0)
 			{
-				bc = token;
+				fprintf(stderr, "COMPILATION ERROR: .word needs at least a value at line %zu\n", line_count);
+				exit(ERR_COMPILATION_FAILED);
 			}
-			else
+
+			size_t i;
+			for (i = 0; i < args_count; i++)
 			{
-				cc = token;
+				Item* item = append_item(program, line_count);
+				item->is_word = 1;
+				parse_value(args[i], line_count, &item->word, &item->symbol);
 			}
 		}
+		else
+		{
+			fprintf(stderr, "COMPILATION ERROR: Invalid directive '%s' found at line %zu\n", code, line_count);
+			exit(ERR_COMPILATION_FAILED);
+		}
+
+		return;
+	}
+
+	uint8_t code_number = get_operation_code(code);
 
-		token = strtok(NULL, " \n");
+	if (code_number == INVALID_OPERATION_CODE)
+	{
+		fprintf(stderr, "COMPILATION ERROR: Invalid operation '%s' found at line %zu\n", code, line_count);
+		exit(ERR_COMPILATION_FAILED);
 	}
 
 	if (code_number < 13)
 	{
-		if (ac == NULL || bc == NULL || cc == NULL)
+		if (args_count != 3)
+		{
+			fprintf(stderr, "COMPILATION ERROR: Wrong number of arguments at line %zu\n", line_count);
+			exit(ERR_COMPILATION_FAILED);
+		}
+
+		uint8_t a = parse_register(args[0], line_count);
+		uint8_t b = parse_register(args[1], line_count);
+		uint8_t c = parse_register(args[2], line_count);
+
+		append_operation(program, encode_standard(code_number, a, b, c), line_count);
+	}
+	else if (code_number == 13)
+	{
+		if (args_count != 2)
 		{
 			fprintf(stderr, "COMPILATION ERROR: Wrong number of arguments at line %zu\n", line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		uint8_t a = strtol(ac, &number_end, 10);
-		uint8_t b = strtol(bc, &number_end, 10);
-		uint8_t c = strtol(cc, &number_end, 10);
+		uint32_t value = 0;
+		char* symbol = NULL;
+
+		uint8_t a = parse_register(args[0], line_count);
 
-		if (errno == ERANGE)
+		if (!parse_value(args[1], line_count, &value, &symbol) && value > MAX_PUT_VALUE)
 		{
-			fprintf(stderr, "COMPILATION ERROR: One of the registers as a wrong value at line %zu\n", line_count);
+			fprintf(stderr, "COMPILATION ERROR: Out of range value '%u' at line %zu\n", value, line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		if (a >= 8)
+		append_operation(program, encode_put(a, value), line_count)->symbol = symbol;
+	}
+	else if (code_number == PSEUDO_LI)
+	{
+		// li a value [scratch]
+
+		if (args_count != 2 && args_count != 3)
 		{
-			fprintf(stderr, "COMPILATION ERROR: Wrong register number for a '%d' at line %zu\n", a, line_count);
+			fprintf(stderr, "COMPILATION ERROR: Wrong number of arguments at line %zu\n", line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		if (b >= 8)
+		uint8_t a = parse_register(args[0], line_count);
+		uint8_t scratch = args_count == 3 ? parse_register(args[2], line_count) : NO_REGISTER;
+		uint32_t value = 0;
+		char* symbol = NULL;
+
+		if (scratch == a)
 		{
-			fprintf(stderr, "COMPILATION ERROR: Wrong register number for b '%d' at line %zu\n", a, line_count);
+			fprintf(stderr, "COMPILATION ERROR: The scratch register must differ from the target at line %zu\n", line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		if (c >= 8)
+		if (parse_value(args[1], line_count, &value, &symbol))
 		{
-			fprintf(stderr, "COMPILATION ERROR: Wrong register number for c '%d' at line %zu\n", a, line_count);
+			// Labels are resolved by the linker into a single put
+
+			append_operation(program, encode_put(a, value), line_count)->symbol = symbol;
+			return;
+		}
+
+		uint32_t sequence[MAX_CONSTANT_SEQUENCE];
+		size_t size = constant_sequence(a, value, scratch, sequence);
+
+		if (!size)
+		{
+			fprintf(stderr, "COMPILATION ERROR: Loading %u needs a scratch register (li a value scratch) at line %zu\n", value, line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		op->standard.number = code_number;
-		op->standard.a = a;
-		op->standard.b = b;
-		op->standard.c = c;
+		size_t i;
+		for (i = 0; i < size; i++)
+			append_operation(program, sequence[i], line_count);
 	}
-	else
+	else if (code_number == PSEUDO_JMP)
 	{
-		if (ac == NULL || bc == NULL)
+		// jmp target b c => put b 0; put c target; load 0 b c
+
+		if (args_count != 3)
 		{
 			fprintf(stderr, "COMPILATION ERROR: Wrong number of arguments at line %zu\n", line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		uint8_t a = strtol(ac, &number_end, 10);
-		uint32_t value = strtol(bc, &number_end, 10);
+		uint8_t b = parse_register(args[1], line_count);
+		uint8_t c = parse_register(args[2], line_count);
+		uint32_t value = 0;
+		char* symbol = NULL;
 
-		if (errno == ERANGE)
+		if (b == c)
 		{
-			fprintf(stderr, "COMPILATION ERROR: The register or value has a wrong value at line %zu\n", line_count);
+			fprintf(stderr, "COMPILATION ERROR: jmp needs two different registers at line %zu\n", line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		if (a >= 8)
+		if (!parse_value(args[0], line_count, &value, &symbol) && value > MAX_PUT_VALUE)
 		{
-			fprintf(stderr, "COMPILATION ERROR: Wrong register number for a '%d' at line %zu\n", a, line_count);
+			fprintf(stderr, "COMPILATION ERROR: Out of range jump target '%u' at line %zu\n", value, line_count);
 			exit(ERR_COMPILATION_FAILED);
 		}
 
-		if (value >= 33554432) // 25 bits
+		append_operation(program, encode_put(b, 0), line_count);
+		append_operation(program, encode_put(c, value), line_count)->symbol = symbol;
+		append_operation(program, encode_standard(12, 0, b, c), line_count);
+	}
+}
+
+uint8_t parse_register(const char* token, size_t line_count)
+{
+	const char* digits = token;
+	char* number_end = NULL;
+
+	if (*digits == 'r' || *digits == 'R')
+		digits++;
+
+	errno = 0;
+	long value = strtol(digits, &number_end, 10);
+
+	if (errno == ERANGE || number_end == digits || *number_end != '\0' || value < 0 || value >= 8)
+	{
+		fprintf(stderr, "COMPILATION ERROR: Wrong register '%s' at line %zu\n", token, line_count);
+		exit(ERR_COMPILATION_FAILED);
+	}
+
+	return (uint8_t)value;
+}
+
+/**
+ * Parses a decimal, hexadecimal (0x) or character literal.
+ * Anything that looks like an identifier is treated as a
+ * symbol instead: in that case 1 is returned and the value
+ * is left to the linker.
+ */
+
+int parse_value(const char* token, size_t line_count, uint32_t* value, char** symbol)
+{
+	*value = 0;
+	*symbol = NULL;
+
+	if (token[0] == '\'')
+	{
+		char c = token[1];
+
+		if (c == '\\')
 		{
-			fprintf(stderr, "COMPILATION ERROR: Out of range value '%d' at line %zu\n", value, line_count);
-			exit(ERR_COMPILATION_FAILED);
+			switch(token[2])
+			{
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case '0': c = '\0'; break;
+				default: c = token[2]; break;
+			}
 		}
 
-		op->put.number = code_number;
-		op->put.a = a;
-		op->put.value = value;
+		*value = (uint8_t)c;
+		return 0;
+	}
+
+	if (is_symbol_name(token))
+	{
+		*symbol = strdup(token);
+		return 1;
+	}
+
+	char* number_end = NULL;
+	int base = 10;
+
+	if (token[0] == '0' && (token[1] == 'x' || token[1] == 'X'))
+		base = 16;
+
+	errno = 0;
+	unsigned long long number = strtoull(token, &number_end, base);
+
+	if (errno == ERANGE || number_end == token || *number_end != '\0' || number > UINT32_MAX || token[0] == '-')
+	{
+		fprintf(stderr, "COMPILATION ERROR: Invalid value '%s' at line %zu\n", token, line_count);
+		exit(ERR_COMPILATION_FAILED);
+	}
+
+	*value = (uint32_t)number;
+	return 0;
+}
+
+int is_symbol_name(const char* token)
+{
+	if (!isalpha((unsigned char)token[0]) && token[0] != '_' && token[0] != '.')
+		return 0;
+
+	const char* p;
+	for (p = token; *p; p++)
+	{
+		if (!isalnum((unsigned char)*p) && *p != '_' && *p != '.')
+			return 0;
+	}
+
+	return 1;
+}
+
+void* grow_array(void* array, size_t* capacity, size_t size, size_t element_size)
+{
+	if (size < *capacity)
+		return array;
+
+	*capacity = *capacity ? *capacity * 2 : 64;
+	array = realloc(array, *capacity * element_size);
+
+	if (array == NULL)
+	{
+		fprintf(stderr, "FATAL: Out of memory while assembling\n");
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	return array;
+}
+
+Item* append_item(Program* program, size_t line_count)
+{
+	Section* section = &program->sections[program->current_section];
+	section->items = (Item*)grow_array(section->items, &section->capacity, section->size, sizeof(Item));
+
+	Item* item = &section->items[section->size++];
+	memset(item, 0, sizeof(Item));
+	item->line = line_count;
+
+	return item;
+}
+
+Item* append_operation(Program* program, uint32_t platter, size_t line_count)
+{
+	Item* item = append_item(program, line_count);
+	item->platter = platter;
+
+	return item;
+}
+
+void define_label(Program* program, const char* name, size_t line_count)
+{
+	if (!is_symbol_name(name))
+	{
+		fprintf(stderr, "COMPILATION ERROR: Invalid label name '%s' at line %zu\n", name, line_count);
+		exit(ERR_COMPILATION_FAILED);
+	}
+
+	Label* existing = find_label(program, name);
+
+	if (existing != NULL)
+	{
+		fprintf(stderr, "COMPILATION ERROR: Label '%s' at line %zu was already defined at line %zu\n", name, line_count, existing->line);
+		exit(ERR_COMPILATION_FAILED);
+	}
+
+	program->labels = (Label*)grow_array(program->labels, &program->labels_capacity, program->labels_count, sizeof(Label));
+
+	Label* label = &program->labels[program->labels_count++];
+	label->name = strdup(name);
+	label->section = program->current_section;
+	label->index = program->sections[program->current_section].size;
+	label->line = line_count;
+}
+
+Label* find_label(Program* program, const char* name)
+{
+	size_t i;
+	for (i = 0; i < program->labels_count; i++)
+	{
+		if (strcmp(program->labels[i].name, name) == 0)
+			return &program->labels[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * The data section is laid out right after the code.
+ */
+
+uint32_t label_address(Program* program, Label* label)
+{
+	if (label->section == SECTION_TEXT)
+		return label->index;
+
+	return program->sections[SECTION_TEXT].size + label->index;
+}
+
+/**
+ * Builds the shortest sequence loading value into register a,
+ * returning its length or 0 if it can't be done without
+ * a scratch register. The candidates are, in order of size:
+ *
+ *   put a v                                   (v < 2^25)
+ *   put a ~v; nand a a a                      (~v < 2^25)
+ *   put a x; put s y; add a a s               (v = x + y)
+ *   put a h; put s 2^k; mult a a s            (v = h * 2^k)
+ *   put a h; put s 2^k; mult a a s; put s l; add a a s
+ *
+ * where the last three may also be built on ~v and followed
+ * by a nand.
+ */
+
+size_t constant_sequence(uint8_t a, uint32_t value, uint8_t scratch, uint32_t* sequence)
+{
+	uint32_t best[MAX_CONSTANT_SEQUENCE];
+	uint32_t candidate[MAX_CONSTANT_SEQUENCE];
+	size_t best_size = 0;
+	int complement;
+
+	memset(best, 0, sizeof(best));
+
+	#define EMIT_PUT(reg, v) \
+		do { candidate[size++] = encode_put((reg), (v)); } while(0)
+
+	#define EMIT_STANDARD(n, ra, rb, rc) \
+		do { candidate[size++] = encode_standard((n), (ra), (rb), (rc)); } while(0)
+
+	#define KEEP_CANDIDATE() \
+		do { if (!best_size || size < best_size) { memcpy(best, candidate, size * sizeof(uint32_t)); best_size = size; } } while(0)
+
+	for (complement = 0; complement < 2; complement++)
+	{
+		uint32_t v = complement ? ~value : value;
+		size_t size = 0;
+
+		if (v <= MAX_PUT_VALUE)
+		{
+			EMIT_PUT(a, v);
+		}
+		else if (scratch != NO_REGISTER && v <= 2 * MAX_PUT_VALUE)
+		{
+			EMIT_PUT(a, v - MAX_PUT_VALUE);
+			EMIT_PUT(scratch, MAX_PUT_VALUE);
+			EMIT_STANDARD(3, a, a, scratch);
+		}
+		else if (scratch != NO_REGISTER)
+		{
+			size_t k;
+			size_t shortest = 0;
+			size_t shortest_shift = 0;
+
+			for (k = 7; k <= 24; k++)
+			{
+				size_t cost = (v & ((1u << k) - 1)) ? 5 : 3;
+
+				if ((v >> k) <= MAX_PUT_VALUE && (!shortest || cost < shortest))
+				{
+					shortest = cost;
+					shortest_shift = k;
+				}
+			}
+
+			EMIT_PUT(a, v >> shortest_shift);
+			EMIT_PUT(scratch, 1u << shortest_shift);
+			EMIT_STANDARD(4, a, a, scratch);
+
+			if (shortest == 5)
+			{
+				EMIT_PUT(scratch, v & ((1u << shortest_shift) - 1));
+				EMIT_STANDARD(3, a, a, scratch);
+			}
+		}
+		else
+		{
+			continue;
+		}
+
+		if (complement)
+			EMIT_STANDARD(6, a, a, a);
+
+		KEEP_CANDIDATE();
+	}
+
+	#undef EMIT_PUT
+	#undef EMIT_STANDARD
+	#undef KEEP_CANDIDATE
+
+	memcpy(sequence, best, best_size * sizeof(uint32_t));
+	return best_size;
+}
+
+/**
+ * Optimizes the text section one basic block at a time,
+ * returning the number of instructions removed. Blocks end
+ * at labels, data words, halt and load: the pass relies on
+ * every jump target being labelled and on the program never
+ * amending its own code.
+ */
+
+size_t optimize_program(Program* program)
+{
+	Section* text = &program->sections[SECTION_TEXT];
+	size_t removed = 0;
+	size_t changes;
+
+	do
+	{
+		changes = 0;
+
+		// Labels only move when the section is compacted
+
+		uint8_t* labelled = (uint8_t*)calloc(text->size + 1, sizeof(uint8_t));
+
+		if (labelled == NULL)
+		{
+			fprintf(stderr, "FATAL: Out of memory while optimizing\n");
+			exit(ERR_OUT_OF_MEMORY);
+		}
+
+		size_t i;
+		for (i = 0; i < program->labels_count; i++)
+		{
+			if (program->labels[i].section == SECTION_TEXT)
+				labelled[program->labels[i].index] = 1;
+		}
+
+		size_t start = 0;
+		for (i = 1; i <= text->size; i++)
+		{
+			if (i == text->size || is_block_boundary(text->items, labelled, i))
+			{
+				changes += propagate_constants(text->items, start, i);
+				changes += eliminate_dead_stores(text->items, start, i);
+				start = i;
+			}
+		}
+
+		free(labelled);
+
+		size_t size = text->size;
+		compact_section(program, SECTION_TEXT);
+		removed += size - text->size;
+	}
+	while (changes);
+
+	return removed;
+}
+
+int is_block_boundary(Item* items, const uint8_t* labelled, size_t index)
+{
+	uint32_t previous = operation_number(items[index - 1].platter);
+
+	if (items[index].is_word || items[index - 1].is_word)
+		return 1;
+
+	if (previous == 7 || previous == 12)
+		return 1;
+
+	return labelled[index];
+}
+
+/**
+ * Forward pass tracking which registers hold a known value:
+ * folds arithmetic on constants into puts, drops puts and
+ * moves that don't change anything and resolves cmoves
+ * whose condition is known.
+ */
+
+size_t propagate_constants(Item* items, size_t start, size_t end)
+{
+	uint8_t known[8] = { 0 };
+	uint32_t values[8] = { 0 };
+	size_t changes = 0;
+
+	#define SET_KNOWN(reg, v) do { known[(reg)] = 1; values[(reg)] = (v); } while(0)
+	#define IS_KNOWN(reg, v) (known[(reg)] && values[(reg)] == (v))
+
+	size_t i;
+	for (i = start; i < end; i++)
+	{
+		Item* item = &items[i];
+
+		// Data words in the text section aren't executed
+
+		if (item->removed || item->is_word)
+			continue;
+
+		uint32_t number = operation_number(item->platter);
+		uint8_t a = operation_a(item->platter);
+		uint8_t b = operation_b(item->platter);
+		uint8_t c = operation_c(item->platter);
+
+		switch(number)
+		{
+			case 0:
+				if (a == b || (known[c] && values[c] == 0) || (known[b] && IS_KNOWN(a, values[b])))
+				{
+					item->removed = 1;
+					changes++;
+				}
+				else if (known[c] && known[b] && values[b] <= MAX_PUT_VALUE)
+				{
+					uint32_t value = values[b];
+					item->platter = encode_put(a, value);
+					SET_KNOWN(a, value);
+					changes++;
+				}
+				else if (known[c] && known[b])
+				{
+					SET_KNOWN(a, values[b]);
+				}
+				else
+				{
+					known[a] = 0;
+				}
+				break;
+
+			case 3:
+			case 4:
+			case 5:
+			case 6:
+				if (known[b] && known[c] && (number != 5 || values[c] != 0))
+				{
+					uint32_t value;
+
+					if (number == 3)
+						value = values[b] + values[c];
+					else if (number == 4)
+						value = values[b] * values[c];
+					else if (number == 5)
+						value = values[b] / values[c];
+					else
+						value = ~(values[b] & values[c]);
+
+					if (IS_KNOWN(a, value))
+					{
+						item->removed = 1;
+						changes++;
+					}
+					else if (value <= MAX_PUT_VALUE)
+					{
+						item->platter = encode_put(a, value);
+						changes++;
+					}
+
+					SET_KNOWN(a, value);
+					break;
+				}
+
+				// nand a x x; nand a a a is just a move of x into a
+
+				if (number == 6 && b == c && i + 1 < end && !items[i + 1].removed)
+				{
+					uint32_t next = items[i + 1].platter;
+
+					if (next == encode_standard(6, a, a, a))
+					{
+						if (a == b)
+						{
+							item->removed = 1;
+							items[i + 1].removed = 1;
+							changes++;
+							i++;
+							break;
+						}
+
+						uint8_t r;
+						for (r = 0; r < 8; r++)
+						{
+							if (r != a && known[r] && values[r] != 0)
+								break;
+						}
+
+						if (r < 8)
+						{
+							item->platter = encode_standard(0, a, b, r);
+							items[i + 1].removed = 1;
+							changes++;
+							i++;
+						}
+					}
+				}
+
+				known[a] = 0;
+				break;
+
+			case 1:
+				known[a] = 0;
+				break;
+
+			case 8:
+				known[b] = 0;
+				break;
+
+			case 11:
+				known[c] = 0;
+				break;
+
+			case 13:
+				if (item->symbol == NULL && IS_KNOWN(put_register(item->platter), put_value(item->platter)))
+				{
+					item->removed = 1;
+					changes++;
+				}
+				else if (item->symbol == NULL)
+				{
+					SET_KNOWN(put_register(item->platter), put_value(item->platter));
+				}
+				else
+				{
+					known[put_register(item->platter)] = 0;
+				}
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	#undef SET_KNOWN
+	#undef IS_KNOWN
+
+	return changes;
+}
+
+/**
+ * Backward pass removing side-effect free instructions
+ * whose result is overwritten before being read. Every
+ * register is considered live at the end of the block.
+ */
+
+size_t eliminate_dead_stores(Item* items, size_t start, size_t end)
+{
+	uint8_t live = 0xFF;
+	size_t changes = 0;
+	size_t i;
+
+	#define REG(r) ((uint8_t)(1 << (r)))
+
+	for (i = end; i-- > start;)
+	{
+		Item* item = &items[i];
+
+		// Data words in the text section aren't executed
+
+		if (item->removed || item->is_word)
+			continue;
+
+		uint32_t number = operation_number(item->platter);
+		uint8_t a = operation_a(item->platter);
+		uint8_t b = operation_b(item->platter);
+		uint8_t c = operation_c(item->platter);
+		uint8_t written = 0;
+		uint8_t read = 0;
+		int pure = 0;
+
+		switch(number)
+		{
+			case 0: written = 0; read = REG(a) | REG(b) | REG(c); pure = 1; break;
+			case 1: written = REG(a); read = REG(b) | REG(c); break;
+			case 2: read = REG(a) | REG(b) | REG(c); break;
+			case 3:
+			case 4:
+			case 6: written = REG(a); read = REG(b) | REG(c); pure = 1; break;
+			case 5: written = REG(a); read = REG(b) | REG(c); break;
+			case 8: written = REG(b); read = REG(c); break;
+			case 9:
+			case 10: read = REG(c); break;
+			case 11: written = REG(c); break;
+			case 12: read = REG(b) | REG(c); break;
+			case 13: written = REG(put_register(item->platter)); pure = 1; break;
+			default: break;
+		}
+
+		// A cmove only writes conditionally, so it can't kill a
+		// register, but it's useless if its target is dead.
+
+		if (number == 0 && !(live & REG(a)))
+		{
+			item->removed = 1;
+			changes++;
+			continue;
+		}
+
+		if (pure && written && !(live & written))
+		{
+			item->removed = 1;
+			changes++;
+			continue;
+		}
+
+		live = (live & ~written) | read;
+	}
+
+	#undef REG
+
+	return changes;
+}
+
+/**
+ * Drops removed items, moving labels accordingly.
+ */
+
+void compact_section(Program* program, uint8_t s)
+{
+	Section* section = &program->sections[s];
+	size_t* remap = (size_t*)malloc((section->size + 1) * sizeof(size_t));
+
+	if (remap == NULL)
+	{
+		fprintf(stderr, "FATAL: Out of memory while optimizing\n");
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	size_t kept = 0;
+	size_t i;
+	for (i = 0; i < section->size; i++)
+	{
+		remap[i] = kept;
+
+		if (!section->items[i].removed)
+			section->items[kept++] = section->items[i];
+	}
+
+	remap[section->size] = kept;
+
+	for (i = 0; i < program->labels_count; i++)
+	{
+		if (program->labels[i].section == s)
+			program->labels[i].index = remap[program->labels[i].index];
+	}
+
+	section->size = kept;
+	free(remap);
+}
+
+/**
+ * Resolves every symbol reference and writes the text
+ * section followed by the data section.
+ */
+
+void link_program(Program* program, FILE* output_file)
+{
+	uint8_t s;
+	for (s = 0; s < SECTIONS_COUNT; s++)
+	{
+		Section* section = &program->sections[s];
+
+		size_t i;
+		for (i = 0; i < section->size; i++)
+		{
+			Item* item = &section->items[i];
+			uint32_t address = 0;
+
+			if (item->symbol != NULL)
+			{
+				Label* label = find_label(program, item->symbol);
+
+				if (label == NULL)
+				{
+					fprintf(stderr, "LINK ERROR: Undefined symbol '%s' at line %zu\n", item->symbol, item->line);
+					exit(ERR_COMPILATION_FAILED);
+				}
+
+				address = label_address(program, label);
+			}
+
+			if (item->is_word)
+			{
+				write_platter(item->word + address, output_file);
+				continue;
+			}
+
+			if (operation_number(item->platter) == OPERATION_ORTHOGRAPHY && item->symbol != NULL)
+			{
+				uint32_t value = put_value(item->platter) + address;
+
+				if (value > MAX_PUT_VALUE)
+				{
+					fprintf(stderr, "LINK ERROR: Address of '%s' doesn't fit a put at line %zu\n", item->symbol, item->line);
+					exit(ERR_COMPILATION_FAILED);
+				}
+
+				item->platter = encode_put(put_register(item->platter), value);
+			}
+
+			write_platter(item->platter, output_file);
+		}
+	}
+}
+
+/**
+ * Platters are stored big-endian, as expected by the machine.
+ */
+
+void write_platter(uint32_t value, FILE* output_file)
+{
+	uint8_t bytes[4] = {
+		(uint8_t)(value >> 24),
+		(uint8_t)(value >> 16),
+		(uint8_t)(value >> 8),
+		(uint8_t)value
+	};
+
+	if (fwrite(bytes, sizeof(bytes), 1, output_file) != 1)
+	{
+		fprintf(stderr, "FATAL: Can't write to the output file\n");
+		exit(ERR_INVALID_OUTPUT_FILE);
 	}
 }
 
@@ -247,6 +1162,10 @@ uint8_t get_operation_code(const char* code)
 		return 12;
 	else if (strcmp(code, "put") == 0)
 		return 13;
+	else if (strcmp(code, "li") == 0)
+		return PSEUDO_LI;
+	else if (strcmp(code, "jmp") == 0)
+		return PSEUDO_JMP;
 
 	return INVALID_OPERATION_CODE;
 }
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "debugger.h"
+
+static void write_help(void);
+static void write_location(Machine* machine);
+static void write_listing(Machine* machine, uint32_t from, uint32_t count);
+static void write_registers(Machine* machine);
+static void examine_array(Machine* machine, uint32_t index, uint32_t from, uint32_t count);
+static void write_points(Machine* machine);
+static int parse_number(const char* word, uint32_t* value);
+
+/**
+ * Reads commands until quit or the end of the commands,
+ * and returns the status the machine was left in. The
+ * machine is isolated so that a fatal error stops it for
+ * inspection instead of ending the process.
+ */
+
+MachineStatus debug_machine(Machine* machine, FILE* commands)
+{
+	char line[DEBUGGER_MAX_LINE];
+	MachineStatus status = MACHINE_PREEMPTED;
+
+	machine->isolated = 1;
+	write_location(machine);
+
+	for (;;)
+	{
+		printf(DEBUGGER_PROMPT);
+		fflush(stdout);
+
+		if (fgets(line, sizeof(line), commands) == NULL)
+			break;
+
+		char* words[4] = { NULL, NULL, NULL, NULL };
+		uint32_t values[3] = { 0, 0, 0 };
+		int count = 0;
+		char* word = strtok(line, " \t\r\n");
+
+		while (word != NULL && count < 4)
+		{
+			words[count++] = word;
+			word = strtok(NULL, " \t\r\n");
+		}
+
+		if (count == 0)
+			continue;
+
+		int i;
+		int valid = 1;
+
+		for (i = 1; i < count; i++)
+			valid &= parse_number(words[i], &values[i - 1]);
+
+		if (!valid)
+		{
+			printf("Invalid number, see help\n");
+			continue;
+		}
+
+		char* command = words[0];
+		int running = status != MACHINE_HALTED && status != MACHINE_FAILED;
+
+		if (!strcmp(command, "q") || !strcmp(command, "quit"))
+		{
+			break;
+		}
+		else if (!strcmp(command, "h") || !strcmp(command, "help"))
+		{
+			write_help();
+		}
+		else if ((!strcmp(command, "b") || !strcmp(command, "break")) && count == 2)
+		{
+			machine_set_breakpoint(machine, values[0], 1);
+		}
+		else if ((!strcmp(command, "d") || !strcmp(command, "delete")) && count == 2)
+		{
+			machine_set_breakpoint(machine, values[0], 0);
+		}
+		else if ((!strcmp(command, "w") || !strcmp(command, "watch")) && count >= 2)
+		{
+			machine_set_watchpoint(machine, values[0], count == 3 ? values[1] : WATCH_ANY_OFFSET, 1);
+		}
+		else if ((!strcmp(command, "u") || !strcmp(command, "unwatch")) && count >= 2)
+		{
+			machine_set_watchpoint(machine, values[0], count == 3 ? values[1] : WATCH_ANY_OFFSET, 0);
+		}
+		else if (!strcmp(command, "i") || !strcmp(command, "info"))
+		{
+			write_points(machine);
+		}
+		else if (!strcmp(command, "r") || !strcmp(command, "registers"))
+		{
+			write_registers(machine);
+		}
+		else if ((!strcmp(command, "x") || !strcmp(command, "examine")) && count >= 2)
+		{
+			examine_array(machine, values[0], values[1], count == 4 ? values[2] : DEFAULT_EXAMINE_COUNT);
+		}
+		else if (!strcmp(command, "l") || !strcmp(command, "list"))
+		{
+			uint32_t pc = machine->registers[PC_REGISTER];
+			uint32_t from = count >= 2 ? values[0] : (pc > DEFAULT_LIST_COUNT / 2 ? pc - DEFAULT_LIST_COUNT / 2 : 0);
+
+			write_listing(machine, from, count == 3 ? values[1] : DEFAULT_LIST_COUNT);
+		}
+		else if ((!strcmp(command, "s") || !strcmp(command, "step")
+			|| !strcmp(command, "c") || !strcmp(command, "continue")) && !running)
+		{
+			printf("The program is not running\n");
+		}
+		else if (!strcmp(command, "s") || !strcmp(command, "step"))
+		{
+			uint32_t steps = count == 2 && values[0] ? values[0] : 1;
+
+			do
+				status = machine_step(machine);
+			while (--steps && status == MACHINE_RUNNING);
+
+			write_location(machine);
+		}
+		else if (!strcmp(command, "c") || !strcmp(command, "continue"))
+		{
+			// The operation under a breakpoint has to go first
+
+			status = machine_step(machine);
+
+			if (status == MACHINE_RUNNING)
+				status = machine_run(machine);
+
+			write_location(machine);
+		}
+		else
+		{
+			printf("Unknown command, see help\n");
+		}
+	}
+
+	return status;
+}
+
+static void write_help(void)
+{
+	printf(
+		"b pc                  break before executing the platter at pc\n"
+		"d pc                  delete that breakpoint\n"
+		"w array [offset]      stop before the program amends the array, or one of its platters\n"
+		"u array [offset]      remove that watchpoint\n"
+		"i                     list breakpoints and watchpoints\n"
+		"s [count]             execute count operations\n"
+		"c                     continue until a breakpoint, a watchpoint or the end\n"
+		"r                     show the registers\n"
+		"x array offset [n]    show n platters of an array\n"
+		"l [pc [n]]            disassemble n platters of the '0' array\n"
+		"q                     quit\n"
+		"Numbers are decimal, or hexadecimal with 0x.\n"
+	);
+}
+
+/**
+ * Tells why the machine stopped and where, along with the
+ * amendment a watchpoint stopped.
+ */
+
+static void write_location(Machine* machine)
+{
+	uint32_t pc = machine->registers[PC_REGISTER];
+
+	switch (machine->status)
+	{
+		case MACHINE_HALTED:
+			printf("Halted at cycle %llu\n", (unsigned long long)machine->cycle);
+			return;
+
+		case MACHINE_FAILED:
+			printf("Failed at cycle %llu, pc %08x\n", (unsigned long long)machine->cycle, pc);
+			return;
+
+		default:
+			break;
+	}
+
+	if (pc >= machine->code_size)
+	{
+		printf("pc %08x is beyond the '0' array\n", pc);
+		return;
+	}
+
+	uint32_t platter = machine->code[pc].platter;
+
+	if (machine->status == MACHINE_BREAKPOINT && machine->code[pc].handler == HANDLER_WATCHED_AMENDMENT)
+	{
+		uint32_t array = machine->registers[operation_a(platter)];
+		uint32_t offset = machine->registers[operation_b(platter)];
+		uint32_t value = machine->registers[operation_c(platter)];
+
+		printf("Watchpoint: array %u at %u becomes %08x\n", array, offset, value);
+	}
+
+	printf("cycle %llu\n", (unsigned long long)machine->cycle);
+	write_listing(machine, pc, 1);
+}
+
+static void write_listing(Machine* machine, uint32_t from, uint32_t count)
+{
+	char source[MAX_SOURCE_LINE + 1];
+	uint32_t pc = machine->registers[PC_REGISTER];
+	uint32_t i;
+
+	for (i = from; i < machine->code_size && i - from < count; i++)
+	{
+		size_t length = operation_to_source(machine->code[i].platter, source);
+		source[length - 1] = '\0';
+
+		printf("%s%s %08x\t%s\n",
+			i == pc ? ">" : " ",
+			machine->code[i].handler == HANDLER_BREAKPOINT ? "*" : " ",
+			i,
+			source
+		);
+	}
+}
+
+static void write_registers(Machine* machine)
+{
+	uint8_t i;
+	for (i = 0; i < REGISTERS_COUNT; i++)
+		printf("r%u = %08x (%u)\n", i, machine->registers[i], machine->registers[i]);
+
+	printf("pc = %08x, cycle %llu\n", machine->registers[PC_REGISTER], (unsigned long long)machine->cycle);
+}
+
+static void examine_array(Machine* machine, uint32_t index, uint32_t from, uint32_t count)
+{
+	if (index >= machine->memory->size || machine->memory->arrays[index].content == NULL)
+	{
+		printf("Array %u is not allocated\n", index);
+		return;
+	}
+
+	Array* array = &machine->memory->arrays[index];
+	uint32_t i;
+
+	printf("array %u: %u platters\n", index, array->size);
+
+	for (i = from; i < array->size && i - from < count; i++)
+		printf("%08x: %08x (%u)\n", i, array->content[i], array->content[i]);
+}
+
+static void write_points(Machine* machine)
+{
+	uint32_t i;
+
+	for (i = 0; i < machine->breakpoints_count; i++)
+		printf("breakpoint at %08x\n", machine->breakpoints[i]);
+
+	for (i = 0; i < machine->watchpoints_count; i++)
+	{
+		if (machine->watchpoints[i].offset == WATCH_ANY_OFFSET)
+			printf("watchpoint on array %u\n", machine->watchpoints[i].array);
+		else
+			printf("watchpoint on array %u at %u\n", machine->watchpoints[i].array, machine->watchpoints[i].offset);
+	}
+}
+
+static int parse_number(const char* word, uint32_t* value)
+{
+	char* end = NULL;
+	unsigned long number = strtoul(word, &end, 0);
+
+	if (end == word || *end != '\0' || *word == '-' || number > UINT32_MAX)
+		return 0;
+
+	*value = (uint32_t)number;
+	return 1;
+}
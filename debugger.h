@@ -0,0 +1,15 @@
+#if !defined(__DEBUGGER_H)
+#define __DEBUGGER_H
+
+#include <stdio.h>
+
+#include "machine.h"
+
+#define DEBUGGER_PROMPT "(um) "
+#define DEBUGGER_MAX_LINE 256
+#define DEFAULT_LIST_COUNT 10
+#define DEFAULT_EXAMINE_COUNT 8
+
+MachineStatus debug_machine(Machine* machine, FILE* commands);
+
+#endif /* __DEBUGGER_H */
@@ -3,47 +3,148 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
-#include <byteswap.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define ERR_MISSING_ARGUMENTS 2
 #define ERR_INVALID_INPUT_FILE 3
 #define ERR_INVALID_OUTPUT_FILE 4
+#define ERR_OUT_OF_MEMORY 5
 
-#define WRITE_CODE(operation, name, output) \
-	fprintf(output, name " %d %d %d\n", operation->standard.a, operation->standard.b, operation->standard.c)
+#define MAX_THREADS 64
+#define MAX_VALUES 4
+#define MAX_SUCCESSORS (MAX_VALUES + 1)
 
-#define WRITE_CODE_PUT(operation, name, output) \
-	fprintf(output, name " %d %d\n", operation->put.a, operation->put.value)
+#define GRAPH_NONE 0
+#define GRAPH_DOT 1
+#define GRAPH_JSON 2
 
 #include "operation.h"
 
-void write_source_code(Operation* op, FILE* output);
+/**
+ * A contiguous range of platters disassembled by
+ * a single thread into its own buffer.
+ */
+
+typedef struct Chunk {
+	const uint8_t*	bytes;
+	size_t		count;
+	char*		source;
+	size_t		length;
+} Chunk;
+
+/**
+ * The set of values a register can hold at some point
+ * of a basic block, an empty set meaning unknown.
+ */
+
+typedef struct RegisterValues {
+	uint8_t		count;
+	uint32_t	values[MAX_VALUES];
+} RegisterValues;
+
+typedef struct Block {
+	uint32_t	start;
+	uint32_t	end;
+	uint32_t	successors[MAX_SUCCESSORS];
+	uint8_t		successors_count;
+	uint8_t		indirect;
+	uint64_t	executions;
+	uint64_t	instructions;
+} Block;
+
+size_t disassemble(const uint8_t* bytes, size_t count, char* source);
+void* disassemble_chunk(void* chunk);
+void parse_range(const char* range, size_t* start, size_t* end);
+
+void write_graph(const uint8_t* bytes, size_t count, int format, const char* profile_filename, FILE* output);
+size_t find_blocks(const uint32_t* platters, uint32_t count, uint8_t* leaders, Block* blocks);
+void analyze_block(const uint32_t* platters, uint32_t count, const uint8_t* leaders, Block* block, RegisterValues* registers);
+void add_value(RegisterValues* set, uint32_t value);
+int merge_values(RegisterValues* set, const RegisterValues* other);
+void load_profile(const char* profile_filename, Block* blocks, size_t blocks_count);
 
 int main(int argc, char *argv[])
 {
-	if (argc < 2)
+	size_t range_start = 0;
+	size_t range_end = SIZE_MAX;
+	long threads = 1;
+	int graph = GRAPH_NONE;
+	char* profile_filename = NULL;
+	int option;
+
+	while ((option = getopt(argc, argv, "r:j:g:p:")) != -1)
 	{
-		fprintf(stderr, "Usage: %s program [outfile]\n", argv[0]);
+		switch(option)
+		{
+			case 'g':
+				if (strcmp(optarg, "dot") == 0)
+					graph = GRAPH_DOT;
+				else if (strcmp(optarg, "json") == 0)
+					graph = GRAPH_JSON;
+				else
+				{
+					fprintf(stderr, "FATAL: Unknown graph format '%s', expected dot or json\n", optarg);
+					exit(ERR_MISSING_ARGUMENTS);
+				}
+				break;
+
+			case 'p':
+				profile_filename = optarg;
+				break;
+
+			case 'r':
+				parse_range(optarg, &range_start, &range_end);
+				break;
+
+			case 'j':
+				threads = strtol(optarg, NULL, 10);
+
+				if (threads < 1 || threads > MAX_THREADS)
+				{
+					fprintf(stderr, "FATAL: The number of threads must be between 1 and %d\n", MAX_THREADS);
+					exit(ERR_MISSING_ARGUMENTS);
+				}
+				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-r start:end] [-j threads] [-g dot|json [-p profile]] program [outfile]\n", argv[0]);
+				exit(ERR_MISSING_ARGUMENTS);
+		}
+	}
+
+	if (argc - optind < 1)
+	{
+		fprintf(stderr, "Usage: %s [-r start:end] [-j threads] [-g dot|json [-p profile]] program [outfile]\n", argv[0]);
 		exit(ERR_MISSING_ARGUMENTS);
 	}
 
-	char* input_filename = argv[1];
+	char* input_filename = argv[optind];
 	char* output_filename = "output.uma";
 
-	if (argc > 2)
-		output_filename =  argv[2];
+	if (argc - optind > 1)
+		output_filename =  argv[optind + 1];
 
-	FILE* input_file = fopen(input_filename, "r");
+	int input_file = open(input_filename, O_RDONLY);
 
-	if (input_file == NULL)
+	if (input_file == -1)
 	{
 		fprintf(stderr, "FATAL: Can't open input file: %s\n", input_filename);
 		exit(ERR_INVALID_INPUT_FILE);
 	}
 
-	fseek(input_file, 0, SEEK_END);
-	size_t fsize = ftell(input_file);
-	fseek(input_file, 0, SEEK_SET);
+	struct stat info;
+
+	if (fstat(input_file, &info) == -1)
+	{
+		fprintf(stderr, "FATAL: Can't stat input file %s: %d\n", input_filename, errno);
+		exit(ERR_INVALID_INPUT_FILE);
+	}
+
+	size_t fsize = info.st_size;
 
 	if (fsize % sizeof(uint32_t) != 0)
 	{
@@ -51,6 +152,27 @@ int main(int argc, char *argv[])
 		exit(ERR_INVALID_INPUT_FILE);
 	}
 
+	if (range_end > fsize)
+		range_end = fsize;
+
+	if (range_start > range_end)
+		range_start = range_end;
+
+	const uint8_t* bytes = NULL;
+
+	if (fsize > 0)
+	{
+		bytes = (const uint8_t*)mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, input_file, 0);
+
+		if (bytes == MAP_FAILED)
+		{
+			fprintf(stderr, "FATAL: Can't map input file %s: %d\n", input_filename, errno);
+			exit(ERR_INVALID_INPUT_FILE);
+		}
+
+		madvise((void*)bytes, fsize, MADV_SEQUENTIAL);
+	}
+
 	FILE* output_file = fopen(output_filename, "wb");
 
 	if (output_file == NULL)
@@ -59,90 +181,593 @@ int main(int argc, char *argv[])
 		exit(ERR_INVALID_OUTPUT_FILE);
 	}
 
-	Operation op;
-	uint32_t value;
+	// The control flow graph always covers the whole image,
+	// since jumps can land anywhere in it.
 
-	size_t i;
-	for(i = 0; i < fsize; i += sizeof(uint32_t))
+	if (graph != GRAPH_NONE)
+	{
+		write_graph(bytes, fsize / sizeof(uint32_t), graph, profile_filename, output_file);
+
+		fclose(output_file);
+
+		if (bytes != NULL)
+			munmap((void*)bytes, fsize);
+
+		close(input_file);
+		return 0;
+	}
+
+	size_t count = (range_end - range_start) / sizeof(uint32_t);
+	size_t per_thread = (count + threads - 1) / threads;
+	Chunk chunks[MAX_THREADS];
+	pthread_t workers[MAX_THREADS];
+
+	if (per_thread == 0)
+		threads = 0;
+
+	long i;
+	for (i = 0; i < threads; i++)
 	{
-		if (fread(&value, sizeof(uint32_t), 1, input_file) != 1)
+		size_t first = i * per_thread;
+
+		chunks[i].bytes = bytes + range_start + first * sizeof(uint32_t);
+		chunks[i].count = first >= count ? 0 : (count - first < per_thread ? count - first : per_thread);
+
+		if (i > 0 && pthread_create(&workers[i], NULL, disassemble_chunk, &chunks[i]) != 0)
 		{
-			fprintf(stderr, "FATAL: error reading input file %s\n", input_filename);
-			exit(ERR_INVALID_INPUT_FILE);
+			fprintf(stderr, "FATAL: Can't start disassembly thread %ld\n", i);
+			exit(ERR_OUT_OF_MEMORY);
 		}
+	}
+
+	// The first chunk is handled by the main thread
+
+	if (threads > 0)
+		disassemble_chunk(&chunks[0]);
 
-		value = __bswap_32(value);
+	for (i = 0; i < threads; i++)
+	{
+		if (i > 0)
+			pthread_join(workers[i], NULL);
+
+		if (chunks[i].length && fwrite(chunks[i].source, chunks[i].length, 1, output_file) != 1)
+		{
+			fprintf(stderr, "FATAL: Can't write to output file: %s\n", output_filename);
+			exit(ERR_INVALID_OUTPUT_FILE);
+		}
 
-		int_to_operation(value, &op);
-		write_source_code(&op, output_file);
+		free(chunks[i].source);
 	}
 
 	fclose(output_file);
-	fclose(input_file);
+
+	if (bytes != NULL)
+		munmap((void*)bytes, fsize);
+
+	close(input_file);
 }
 
-void write_source_code(Operation* op, FILE* output)
+/**
+ * Parses a byte range in the form start:end, where
+ * either side can be omitted. Offsets must be platter
+ * aligned and can be written in hexadecimal.
+ */
+
+void parse_range(const char* range, size_t* start, size_t* end)
 {
-	switch(op->standard.number)
+	char* separator = NULL;
+
+	*start = strtoull(range, &separator, 0);
+
+	if (*separator != ':')
 	{
-		case 0:
-			WRITE_CODE(op, "cmove", output);
-			break;
+		fprintf(stderr, "FATAL: Invalid range '%s', expected start:end\n", range);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
 
-		case 1:
-			WRITE_CODE(op, "get", output);
-			break;
+	char* terminator = separator + 1;
+	*end = *terminator ? strtoull(separator + 1, &terminator, 0) : SIZE_MAX;
 
-		case 2:
-			WRITE_CODE(op, "set", output);
-			break;
+	if (*terminator != '\0')
+	{
+		fprintf(stderr, "FATAL: Invalid range '%s', expected start:end\n", range);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
 
-		case 3:
-			WRITE_CODE(op, "add", output);
-			break;
+	if (*start % sizeof(uint32_t) != 0 || (*end != SIZE_MAX && *end % sizeof(uint32_t) != 0))
+	{
+		fprintf(stderr, "FATAL: Range '%s' is not aligned to platters\n", range);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
+}
 
-		case 4:
-			WRITE_CODE(op, "mult", output);
-			break;
+void* disassemble_chunk(void* data)
+{
+	Chunk* chunk = (Chunk*)data;
 
-		case 5:
-			WRITE_CODE(op, "div", output);
-			break;
+	chunk->source = NULL;
+	chunk->length = 0;
 
-		case 6:
-			WRITE_CODE(op, "nand", output);
-			break;
+	if (!chunk->count)
+		return NULL;
 
-		case 7:
-			WRITE_CODE(op, "halt", output);
-			break;
+	chunk->source = (char*)malloc(chunk->count * MAX_SOURCE_LINE);
 
-		case 8:
-			WRITE_CODE(op, "allocate", output);
-			break;
+	if (chunk->source == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't allocate the output buffer for %zu platters\n", chunk->count);
+		exit(ERR_OUT_OF_MEMORY);
+	}
 
-		case 9:
-			WRITE_CODE(op, "free", output);
-			break;
+	chunk->length = disassemble(chunk->bytes, chunk->count, chunk->source);
 
-		case 10:
-			WRITE_CODE(op, "out", output);
-			break;
+	return NULL;
+}
+
+/**
+ * Disassembles count big-endian platters into source,
+ * which must be able to hold count * MAX_SOURCE_LINE
+ * bytes. Platters are swapped in blocks so that the
+ * conversion stays vectorized and in cache.
+ */
+
+size_t disassemble(const uint8_t* bytes, size_t count, char* source)
+{
+	uint32_t platters[1024];
+	char* p = source;
 
-		case 11:
-			WRITE_CODE(op, "in", output);
+	size_t i;
+	for (i = 0; i < count; i += 1024)
+	{
+		size_t block = count - i < 1024 ? count - i : 1024;
+		platters_from_big_endian(platters, bytes + i * sizeof(uint32_t), block);
+
+		size_t j;
+		for (j = 0; j < block; j++)
+			p += operation_to_source(platters[j], p);
+	}
+
+	return p - source;
+}
+
+/**
+ * Recovers the basic blocks reachable from the first
+ * platter and writes them as a DOT or JSON graph. If a
+ * profile written by um -p is given, blocks are annotated
+ * with their execution counts and colored by heat.
+ */
+
+void write_graph(const uint8_t* bytes, size_t count, int format, const char* profile_filename, FILE* output)
+{
+	uint32_t* platters = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+	uint8_t* leaders = (uint8_t*)calloc(count + 1, sizeof(uint8_t));
+	Block* blocks = (Block*)malloc((count + 1) * sizeof(Block));
+
+	if (platters == NULL || leaders == NULL || blocks == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't allocate the analysis of %zu platters\n", count);
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	platters_from_big_endian(platters, bytes, count);
+
+	size_t blocks_count = find_blocks(platters, (uint32_t)count, leaders, blocks);
+	uint64_t hottest = 0;
+
+	if (profile_filename != NULL)
+		load_profile(profile_filename, blocks, blocks_count);
+
+	size_t i;
+	for (i = 0; i < blocks_count; i++)
+	{
+		if (blocks[i].instructions > hottest)
+			hottest = blocks[i].instructions;
+	}
+
+	if (format == GRAPH_DOT)
+	{
+		fprintf(output, "digraph cfg {\n\tnode [shape=box fontname=monospace];\n");
+
+		for (i = 0; i < blocks_count; i++)
+		{
+			Block* block = &blocks[i];
+
+			fprintf(output, "\tb%u [label=\"0x%x-0x%x\\n%u instructions", block->start, block->start, block->end - 1, block->end - block->start);
+
+			if (profile_filename != NULL)
+				fprintf(output, "\\n%llu executions\"", (unsigned long long)block->executions);
+			else
+				fprintf(output, "\"");
+
+			if (profile_filename != NULL && block->instructions)
+			{
+				// From yellow to red as the block gets hotter
+
+				unsigned int green = 255 - (unsigned int)(255 * block->instructions / hottest);
+				fprintf(output, " style=filled fillcolor=\"#ff%02x00\"", green);
+			}
+
+			if (block->indirect)
+				fprintf(output, " peripheries=2");
+
+			fprintf(output, "];\n");
+
+			uint8_t j;
+			for (j = 0; j < block->successors_count; j++)
+				fprintf(output, "\tb%u -> b%u;\n", block->start, block->successors[j]);
+		}
+
+		fprintf(output, "}\n");
+	}
+	else
+	{
+		fprintf(output, "{\"blocks\": [");
+
+		for (i = 0; i < blocks_count; i++)
+		{
+			Block* block = &blocks[i];
+
+			fprintf(output, "%s\n\t{\"start\": %u, \"end\": %u, \"instructions\": %u, \"indirect\": %s, \"successors\": [",
+				i ? "," : "", block->start, block->end - 1, block->end - block->start, block->indirect ? "true" : "false"
+			);
+
+			uint8_t j;
+			for (j = 0; j < block->successors_count; j++)
+				fprintf(output, "%s%u", j ? ", " : "", block->successors[j]);
+
+			fprintf(output, "]");
+
+			if (profile_filename != NULL)
+			{
+				fprintf(output, ", \"executions\": %llu, \"executed_instructions\": %llu",
+					(unsigned long long)block->executions, (unsigned long long)block->instructions
+				);
+			}
+
+			fprintf(output, "}");
+		}
+
+		fprintf(output, "\n]}\n");
+	}
+
+	free(blocks);
+	free(leaders);
+	free(platters);
+}
+
+/**
+ * Walks the program from its first platter, propagating
+ * register values along the edges until they are stable.
+ * Jump targets found along the way can split blocks that
+ * were already visited, in which case the walk starts
+ * over. Returns the reachable blocks sorted by address.
+ */
+
+size_t find_blocks(const uint32_t* platters, uint32_t count, uint8_t* leaders, Block* blocks)
+{
+	uint8_t* visited = (uint8_t*)malloc(count + 1);
+	uint8_t* queued = (uint8_t*)malloc(count + 1);
+	uint32_t* worklist = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+	RegisterValues (*states)[8] = malloc((count + 1) * sizeof(*states));
+
+	if (visited == NULL || queued == NULL || worklist == NULL || states == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't allocate the analysis of %u platters\n", count);
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	leaders[0] = 1;
+
+	int changed = count > 0;
+	while (changed)
+	{
+		changed = 0;
+		memset(visited, 0, count + 1);
+		memset(queued, 0, count + 1);
+
+		// Registers start out as 0
+
+		uint8_t r;
+		for (r = 0; r < 8; r++)
+		{
+			states[0][r].count = 1;
+			states[0][r].values[0] = 0;
+		}
+
+		size_t pending = 0;
+		worklist[pending++] = 0;
+		visited[0] = 1;
+		queued[0] = 1;
+
+		while (pending && !changed)
+		{
+			Block block;
+			RegisterValues registers[8];
+
+			block.start = worklist[--pending];
+			queued[block.start] = 0;
+			memcpy(registers, states[block.start], sizeof(registers));
+			analyze_block(platters, count, leaders, &block, registers);
+
+			uint8_t j;
+			for (j = 0; j < block.successors_count; j++)
+			{
+				uint32_t target = block.successors[j];
+				int updated = 0;
+
+				if (!leaders[target])
+				{
+					leaders[target] = 1;
+					changed = 1;
+				}
+
+				if (!visited[target])
+				{
+					visited[target] = 1;
+					memcpy(states[target], registers, sizeof(registers));
+					updated = 1;
+				}
+				else
+				{
+					for (r = 0; r < 8; r++)
+						updated |= merge_values(&states[target][r], &registers[r]);
+				}
+
+				if (updated && !queued[target])
+				{
+					queued[target] = 1;
+					worklist[pending++] = target;
+				}
+			}
+		}
+	}
+
+	size_t blocks_count = 0;
+	uint32_t pc;
+	for (pc = 0; pc < count; pc++)
+	{
+		if (visited[pc])
+		{
+			RegisterValues registers[8];
+			memcpy(registers, states[pc], sizeof(registers));
+
+			blocks[blocks_count].start = pc;
+			analyze_block(platters, count, leaders, &blocks[blocks_count], registers);
+			blocks[blocks_count].executions = 0;
+			blocks[blocks_count].instructions = 0;
+			blocks_count++;
+		}
+	}
+
+	free(states);
+	free(worklist);
+	free(queued);
+	free(visited);
+
+	return blocks_count;
+}
+
+/**
+ * Runs a block from block->start until a halt, a load,
+ * an invalid platter or the next leader, updating the
+ * values registers can hold so that load targets set by
+ * put (possibly through a cmove) are recovered.
+ */
+
+void analyze_block(const uint32_t* platters, uint32_t count, const uint8_t* leaders, Block* block, RegisterValues* registers)
+{
+	block->successors_count = 0;
+	block->indirect = 0;
+
+	uint32_t pc = block->start;
+
+	for (;;)
+	{
+		uint32_t op = platters[pc];
+		uint32_t number = operation_number(op);
+		uint8_t a = operation_a(op);
+		uint8_t b = operation_b(op);
+		uint8_t c = operation_c(op);
+		RegisterValues* rb = &registers[b];
+		RegisterValues* rc = &registers[c];
+
+		pc++;
+
+		if (number == 7 || number > 13)
 			break;
 
-		case 12:
-			WRITE_CODE(op, "load", output);
+		if (number == 12)
+		{
+			if (rb->count == 1 && rb->values[0] == 0 && rc->count)
+			{
+				uint8_t i;
+				for (i = 0; i < rc->count; i++)
+				{
+					if (rc->values[i] < count)
+						block->successors[block->successors_count++] = rc->values[i];
+					else
+						block->indirect = 1;
+				}
+			}
+			else
+			{
+				block->indirect = 1;
+			}
+
 			break;
+		}
+
+		switch(number)
+		{
+			case 0:
+				if (rc->count == 1 && rc->values[0] != 0)
+					registers[a] = *rb;
+				else if (!(rc->count == 1 && rc->values[0] == 0))
+					merge_values(&registers[a], rb);
+				break;
+
+			case 3:
+			case 4:
+			case 5:
+			case 6:
+				if (rb->count == 1 && rc->count == 1 && (number != 5 || rc->values[0] != 0))
+				{
+					uint32_t vb = rb->values[0];
+					uint32_t vc = rc->values[0];
+					uint32_t value;
+
+					if (number == 3)
+						value = vb + vc;
+					else if (number == 4)
+						value = vb * vc;
+					else if (number == 5)
+						value = vb / vc;
+					else
+						value = ~(vb & vc);
+
+					registers[a].count = 0;
+					add_value(&registers[a], value);
+				}
+				else
+				{
+					registers[a].count = 0;
+				}
+				break;
+
+			case 1:
+				registers[a].count = 0;
+				break;
+
+			case 8:
+				registers[b].count = 0;
+				break;
+
+			case 11:
+				registers[c].count = 0;
+				break;
+
+			case 13:
+				registers[put_register(op)].count = 0;
+				add_value(&registers[put_register(op)], put_value(op));
+				break;
+
+			default:
+				break;
+		}
 
-		case 13:
-			WRITE_CODE_PUT(op, "put", output);
+		if (pc >= count)
 			break;
 
-		default:
-			fprintf(output, "# Wrong opcode detected: %d\n", op->standard.number);
+		if (leaders[pc])
+		{
+			block->successors[block->successors_count++] = pc;
 			break;
+		}
+	}
+
+	block->end = pc;
+}
+
+void add_value(RegisterValues* set, uint32_t value)
+{
+	uint8_t i;
+	for (i = 0; i < set->count; i++)
+	{
+		if (set->values[i] == value)
+			return;
+	}
+
+	set->values[set->count++] = value;
+}
+
+/**
+ * Unions other into set, which becomes unknown if either
+ * is unknown or the union has too many values. Returns
+ * whether set changed.
+ */
+
+int merge_values(RegisterValues* set, const RegisterValues* other)
+{
+	if (!set->count)
+		return 0;
+
+	if (!other->count)
+	{
+		set->count = 0;
+		return 1;
 	}
+
+	RegisterValues merged = *set;
+
+	uint8_t i;
+	for (i = 0; i < other->count; i++)
+	{
+		uint8_t j;
+		for (j = 0; j < merged.count && merged.values[j] != other->values[i]; j++);
+
+		if (j == merged.count)
+		{
+			if (merged.count == MAX_VALUES)
+			{
+				set->count = 0;
+				return 1;
+			}
+
+			merged.values[merged.count++] = other->values[i];
+		}
+	}
+
+	int changed = merged.count != set->count;
+	*set = merged;
+
+	return changed;
+}
+
+/**
+ * Reads the "pc count" lines written by um -p and sums
+ * them into the blocks, which are sorted by address.
+ */
+
+void load_profile(const char* profile_filename, Block* blocks, size_t blocks_count)
+{
+	FILE* profile = fopen(profile_filename, "r");
+
+	if (profile == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't open profile file: %s\n", profile_filename);
+		exit(ERR_INVALID_INPUT_FILE);
+	}
+
+	char line[128];
+	while (fgets(line, sizeof(line), profile) != NULL)
+	{
+		unsigned long pc;
+		unsigned long long executions;
+
+		if (line[0] == '#' || sscanf(line, "%lu %llu", &pc, &executions) != 2)
+			continue;
+
+		size_t low = 0;
+		size_t high = blocks_count;
+
+		while (low < high)
+		{
+			size_t middle = (low + high) / 2;
+
+			if (blocks[middle].end <= pc)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+
+		if (low == blocks_count || blocks[low].start > pc)
+			continue;
+
+		if (blocks[low].start == pc)
+			blocks[low].executions = executions;
+
+		blocks[low].instructions += executions;
+	}
+
+	fclose(profile);
 }
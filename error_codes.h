@@ -9,5 +9,6 @@
 #define ERR_PROGRAM_EXECUTION_ENDED_UNEXPECTEDLY 6
 #define ERR_INVALID_OPCODE 6
 #define ERR_DIVISION_BY_ZERO 7
+#define ERR_INVALID_MACHINE 8
 
 #endif /* __ERROR_CODES_H */
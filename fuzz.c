@@ -0,0 +1,769 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "error_codes.h"
+#include "machine.h"
+
+#define DEFAULT_BUDGET 10000
+#define DEFAULT_ITERATIONS 10000
+#define GENERATED_MAX_PLATTERS 64
+#define GENERATED_MAX_INPUT 16
+#define MAX_REPORT 256
+
+// Not in the spec: both engines fail past this many bytes of arrays
+#define FUZZ_MEMORY_LIMIT (16 << 20)
+
+enum OutcomeStatus {
+	OUTCOME_HALTED,
+	OUTCOME_FAILED,
+	OUTCOME_OUT_OF_BUDGET
+};
+
+static const char* outcome_names[] = { "halted", "failed", "out of budget" };
+
+typedef struct Buffer {
+	uint8_t*	data;
+	size_t		size;
+	size_t		capacity;
+} Buffer;
+
+/**
+ * How a run ended, along with what it wrote. Both engines
+ * fill one, so that they can be compared field by field.
+ */
+
+typedef struct Outcome {
+	int		status;
+	uint64_t	cycles;
+	uint32_t	registers[REGISTERS_COUNT];
+	Buffer		output;
+} Outcome;
+
+/**
+ * The reference engine: a direct reading of the spec with
+ * no shortcuts, failing on every condition the spec calls
+ * a failure. Identifiers follow the same policy as the
+ * machine, the last abandoned one being reused first, as
+ * that's the only choice the spec leaves open that a
+ * program can observe.
+ */
+
+typedef struct Reference {
+	uint32_t	registers[REGISTERS_COUNT];
+	uint32_t	pc;
+	uint32_t**	arrays;
+	uint32_t*	sizes;
+	uint32_t	count;
+	uint32_t	capacity;
+	uint32_t*	abandoned;
+	uint32_t	abandoned_count;
+	uint64_t	live_bytes;
+} Reference;
+
+typedef struct FuzzInput {
+	const uint8_t*	bytes;
+	size_t		size;
+	size_t		position;
+	Buffer*		output;
+} FuzzInput;
+
+uint64_t budget = DEFAULT_BUDGET;
+int verbose = 0;
+
+int diverges(const uint32_t* platters, uint32_t count, const uint8_t* input, size_t input_size, char* report);
+size_t minimize(uint32_t* platters, size_t count, const uint8_t* input, size_t input_size);
+void save_divergence(const uint32_t* platters, size_t count, const uint8_t* input, size_t input_size, const char* name);
+int check_case(const uint8_t* data, size_t size);
+size_t generate_case(uint8_t* data);
+
+void run_reference(Reference* reference, const uint32_t* platters, uint32_t count, const uint8_t* input, size_t input_size, Outcome* outcome);
+int reference_allocate(Reference* reference, uint32_t index, uint32_t size);
+void reference_free(Reference* reference);
+
+void run_machine(Machine* machine, const uint32_t* platters, uint32_t count, const uint8_t* input, size_t input_size, Outcome* outcome);
+int fuzz_read_byte(Machine* machine);
+void fuzz_write_byte(Machine* machine, uint8_t byte);
+void fuzz_out_of_budget(Machine* machine);
+
+int compare_outcomes(Outcome* expected, Outcome* actual, Reference* reference, Machine* machine, char* report);
+void append_byte(Buffer* buffer, uint8_t byte);
+
+/**
+ * libFuzzer entry point. The first byte gives the length
+ * of the input fed to the program, made of the bytes that
+ * follow, and the rest is the program itself, big-endian.
+ */
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	if (check_case(data, size))
+		abort();
+
+	return 0;
+}
+
+#if !defined(LIBFUZZER)
+
+int main(int argc, char *argv[])
+{
+	uint64_t iterations = DEFAULT_ITERATIONS;
+	unsigned int seed = 1;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:s:b:v")) != -1)
+	{
+		switch(option)
+		{
+			case 'n':
+				iterations = strtoull(optarg, NULL, 10);
+				break;
+
+			case 's':
+				seed = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'b':
+				budget = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'v':
+				verbose = 1;
+				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-n iterations] [-s seed] [-b budget] [-v] [case...]\n", argv[0]);
+				exit(ERR_MISSING_ARGUMENTS);
+		}
+	}
+
+	if (budget == 0 || budget > UINT32_MAX)
+	{
+		fprintf(stderr, "FATAL: The budget must be between 1 and %u cycles\n", UINT32_MAX);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
+
+	// Failing programs are the norm here, the messages of
+	// the machine would bury the reports
+
+	if (!verbose)
+		freopen("/dev/null", "w", stderr);
+
+	int failed = 0;
+
+	// Cases given on the command line are checked as is,
+	// which is also how AFL runs the harness
+
+	if (optind < argc)
+	{
+		int i;
+		for (i = optind; i < argc; i++)
+		{
+			FILE* file = fopen(argv[i], "rb");
+
+			if (file == NULL)
+			{
+				printf("Can't open case %s\n", argv[i]);
+				exit(ERR_INVALID_PROGRAM_FILE);
+			}
+
+			fseek(file, 0, SEEK_END);
+			size_t size = ftell(file);
+			fseek(file, 0, SEEK_SET);
+
+			uint8_t* data = (uint8_t*)malloc(size + 1);
+
+			if (data == NULL || fread(data, 1, size, file) != size)
+			{
+				printf("Can't read case %s\n", argv[i]);
+				exit(ERR_INVALID_PROGRAM_FILE);
+			}
+
+			fclose(file);
+
+			failed += check_case(data, size);
+			free(data);
+		}
+
+		return failed ? 1 : 0;
+	}
+
+	srand(seed);
+
+	uint8_t data[1 + GENERATED_MAX_INPUT + GENERATED_MAX_PLATTERS * sizeof(uint32_t)];
+	uint64_t n;
+
+	for (n = 0; n < iterations && !failed; n++)
+		failed += check_case(data, generate_case(data));
+
+	printf("%llu programs checked, %s\n", (unsigned long long)n, failed ? "divergence found" : "no divergence");
+
+	return failed ? 1 : 0;
+}
+
+#endif
+
+/**
+ * Runs a case on both engines. On divergence the program
+ * is minimized and saved along with its input.
+ */
+
+int check_case(const uint8_t* data, size_t size)
+{
+	if (size == 0)
+		return 0;
+
+	size_t input_size = data[0] < size - 1 ? data[0] : size - 1;
+	const uint8_t* input = data + 1;
+	size_t count = (size - 1 - input_size) / sizeof(uint32_t);
+
+	uint32_t* platters = (uint32_t*)malloc(count * sizeof(uint32_t) + 1);
+
+	if (platters == NULL)
+		return 0;
+
+	platters_from_big_endian(platters, input + input_size, count);
+
+	char report[MAX_REPORT];
+
+	if (!diverges(platters, count, input, input_size, report))
+	{
+		free(platters);
+		return 0;
+	}
+
+	printf("Divergence on a program of %zu platters: %s\n", count, report);
+
+	count = minimize(platters, count, input, input_size);
+	diverges(platters, count, input, input_size, report);
+
+	printf("Minimized to %zu platters: %s\n", count, report);
+
+	size_t i;
+	for (i = 0; i < count; i++)
+	{
+		char source[MAX_SOURCE_LINE];
+		size_t length = operation_to_source(platters[i], source);
+		printf("\t%.*s", (int)length, source);
+	}
+
+	save_divergence(platters, count, input, input_size, "divergence");
+
+	free(platters);
+	return 1;
+}
+
+/**
+ * Random programs are only useful if they do something
+ * before failing, so operators are valid, values small and
+ * registers mostly hold small identifiers and offsets.
+ */
+
+size_t generate_case(uint8_t* data)
+{
+	size_t input_size = rand() % (GENERATED_MAX_INPUT + 1);
+	size_t count = 1 + rand() % GENERATED_MAX_PLATTERS;
+
+	data[0] = input_size;
+
+	size_t i;
+	for (i = 0; i < input_size; i++)
+		data[1 + i] = rand();
+
+	uint8_t* p = data + 1 + input_size;
+
+	for (i = 0; i < count; i++)
+	{
+		uint32_t number = rand() % OPCODES_COUNT;
+		uint32_t platter;
+
+		if (number == OPERATION_ORTHOGRAPHY)
+			platter = encode_put(rand() % REGISTERS_COUNT, rand() % 4 == 0 ? (uint32_t)rand() : rand() % 16);
+		else
+			platter = encode_standard(number, rand() % REGISTERS_COUNT, rand() % REGISTERS_COUNT, rand() % REGISTERS_COUNT);
+
+		*p++ = platter >> 24;
+		*p++ = platter >> 16;
+		*p++ = platter >> 8;
+		*p++ = platter;
+	}
+
+	return p - data;
+}
+
+int diverges(const uint32_t* platters, uint32_t count, const uint8_t* input, size_t input_size, char* report)
+{
+	Reference reference;
+	Machine machine;
+	Outcome expected;
+	Outcome actual;
+
+	run_reference(&reference, platters, count, input, input_size, &expected);
+	run_machine(&machine, platters, count, input, input_size, &actual);
+
+	int result = compare_outcomes(&expected, &actual, &reference, &machine, report);
+
+	reference_free(&reference);
+	machine_free(&machine);
+	free(expected.output.data);
+	free(actual.output.data);
+
+	return result;
+}
+
+/**
+ * Delta debugging on the platters: removes chunks of the
+ * program, halving their size whenever none can go, for as
+ * long as the engines still disagree.
+ */
+
+size_t minimize(uint32_t* platters, size_t count, const uint8_t* input, size_t input_size)
+{
+	uint32_t* candidate = (uint32_t*)malloc(count * sizeof(uint32_t) + 1);
+	char report[MAX_REPORT];
+	size_t chunk = count / 2;
+
+	if (candidate == NULL)
+		return count;
+
+	while (chunk > 0)
+	{
+		int removed = 0;
+		size_t start = 0;
+
+		while (start < count)
+		{
+			size_t end = start + chunk < count ? start + chunk : count;
+			size_t size = count - (end - start);
+
+			memcpy(candidate, platters, start * sizeof(uint32_t));
+			memcpy(candidate + start, platters + end, (count - end) * sizeof(uint32_t));
+
+			if (size > 0 && diverges(candidate, size, input, input_size, report))
+			{
+				memcpy(platters, candidate, size * sizeof(uint32_t));
+				count = size;
+				removed = 1;
+			}
+			else
+			{
+				start = end;
+			}
+		}
+
+		if (!removed)
+			chunk /= 2;
+		else if (chunk > count / 2)
+			chunk = count / 2;
+	}
+
+	free(candidate);
+	return count;
+}
+
+/**
+ * Writes the program as an image the machine can run and
+ * its input next to it.
+ */
+
+void save_divergence(const uint32_t* platters, size_t count, const uint8_t* input, size_t input_size, const char* name)
+{
+	char filename[64];
+
+	snprintf(filename, sizeof(filename), "%s.umz", name);
+	FILE* program_file = fopen(filename, "wb");
+
+	snprintf(filename, sizeof(filename), "%s.in", name);
+	FILE* input_file = fopen(filename, "wb");
+
+	if (program_file == NULL || input_file == NULL)
+	{
+		printf("Can't save the divergence as %s\n", name);
+		return;
+	}
+
+	size_t i;
+	for (i = 0; i < count; i++)
+	{
+		uint8_t bytes[4] = {
+			(uint8_t)(platters[i] >> 24),
+			(uint8_t)(platters[i] >> 16),
+			(uint8_t)(platters[i] >> 8),
+			(uint8_t)platters[i]
+		};
+
+		fwrite(bytes, sizeof(bytes), 1, program_file);
+	}
+
+	fwrite(input, 1, input_size, input_file);
+
+	fclose(program_file);
+	fclose(input_file);
+
+	printf("Saved as %s.umz and %s.in\n", name, name);
+}
+
+void run_reference(Reference* reference, const uint32_t* platters, uint32_t count, const uint8_t* input, size_t input_size, Outcome* outcome)
+{
+	memset(reference, 0, sizeof(Reference));
+	memset(outcome, 0, sizeof(Outcome));
+
+	size_t position = 0;
+	uint32_t* r = reference->registers;
+
+	outcome->status = OUTCOME_FAILED;
+
+	if (!reference_allocate(reference, PROGRAM_ARRAY, count))
+		return;
+
+	reference->count = 1;
+	memcpy(reference->arrays[PROGRAM_ARRAY], platters, count * sizeof(uint32_t));
+
+	for (;;)
+	{
+		if (outcome->cycles == budget)
+		{
+			outcome->status = OUTCOME_OUT_OF_BUDGET;
+			break;
+		}
+
+		if (reference->pc >= reference->sizes[PROGRAM_ARRAY])
+			break;
+
+		uint32_t op = reference->arrays[PROGRAM_ARRAY][reference->pc++];
+		uint32_t a = operation_a(op);
+		uint32_t b = operation_b(op);
+		uint32_t c = operation_c(op);
+
+		if (operation_number(op) == 0)
+		{
+			if (r[c] != 0)
+				r[a] = r[b];
+		}
+		else if (operation_number(op) == 1)
+		{
+			if (r[b] >= reference->count || reference->arrays[r[b]] == NULL || r[c] >= reference->sizes[r[b]])
+				break;
+
+			r[a] = reference->arrays[r[b]][r[c]];
+		}
+		else if (operation_number(op) == 2)
+		{
+			if (r[a] >= reference->count || reference->arrays[r[a]] == NULL || r[b] >= reference->sizes[r[a]])
+				break;
+
+			reference->arrays[r[a]][r[b]] = r[c];
+		}
+		else if (operation_number(op) == 3)
+		{
+			r[a] = r[b] + r[c];
+		}
+		else if (operation_number(op) == 4)
+		{
+			r[a] = r[b] * r[c];
+		}
+		else if (operation_number(op) == 5)
+		{
+			if (r[c] == 0)
+				break;
+
+			r[a] = r[b] / r[c];
+		}
+		else if (operation_number(op) == 6)
+		{
+			r[a] = ~(r[b] & r[c]);
+		}
+		else if (operation_number(op) == 7)
+		{
+			outcome->cycles++;
+			outcome->status = OUTCOME_HALTED;
+			break;
+		}
+		else if (operation_number(op) == 8)
+		{
+			uint32_t index = reference->abandoned_count ? reference->abandoned[--reference->abandoned_count] : reference->count;
+
+			if (!reference_allocate(reference, index, r[c]))
+				break;
+
+			if (index == reference->count)
+				reference->count++;
+
+			r[b] = index;
+		}
+		else if (operation_number(op) == 9)
+		{
+			uint32_t index = r[c];
+
+			if (index == PROGRAM_ARRAY || index >= reference->count || reference->arrays[index] == NULL)
+				break;
+
+			reference->live_bytes -= (uint64_t)reference->sizes[index] * sizeof(uint32_t);
+			free(reference->arrays[index]);
+			reference->arrays[index] = NULL;
+			reference->sizes[index] = 0;
+			reference->abandoned[reference->abandoned_count++] = index;
+		}
+		else if (operation_number(op) == 10)
+		{
+			if (r[c] > 255)
+				break;
+
+			append_byte(&outcome->output, r[c]);
+		}
+		else if (operation_number(op) == 11)
+		{
+			r[c] = position < input_size ? input[position++] : 0xFFFFFFFF;
+		}
+		else if (operation_number(op) == 12)
+		{
+			uint32_t index = r[b];
+
+			if (index != PROGRAM_ARRAY)
+			{
+				if (index >= reference->count || reference->arrays[index] == NULL)
+					break;
+
+				uint32_t size = reference->sizes[index];
+				uint32_t* copy = (uint32_t*)malloc(size * sizeof(uint32_t) + 1);
+
+				if (copy == NULL)
+					break;
+
+				memcpy(copy, reference->arrays[index], size * sizeof(uint32_t));
+
+				if (!reference_allocate(reference, PROGRAM_ARRAY, size))
+				{
+					free(copy);
+					break;
+				}
+
+				memcpy(reference->arrays[PROGRAM_ARRAY], copy, size * sizeof(uint32_t));
+				free(copy);
+			}
+
+			reference->pc = r[c];
+		}
+		else if (operation_number(op) == 13)
+		{
+			r[put_register(op)] = put_value(op);
+		}
+		else
+		{
+			break;
+		}
+
+		outcome->cycles++;
+	}
+
+	memcpy(outcome->registers, r, sizeof(outcome->registers));
+}
+
+/**
+ * Gives index a fresh array of size zeroed platters,
+ * replacing the one it had. Fails past FUZZ_MEMORY_LIMIT.
+ */
+
+int reference_allocate(Reference* reference, uint32_t index, uint32_t size)
+{
+	if (index >= reference->capacity)
+	{
+		uint32_t capacity = reference->capacity ? reference->capacity * 2 : 16;
+
+		reference->arrays = (uint32_t**)realloc(reference->arrays, capacity * sizeof(uint32_t*));
+		reference->sizes = (uint32_t*)realloc(reference->sizes, capacity * sizeof(uint32_t));
+		reference->abandoned = (uint32_t*)realloc(reference->abandoned, capacity * sizeof(uint32_t));
+
+		if (reference->arrays == NULL || reference->sizes == NULL || reference->abandoned == NULL)
+		{
+			fprintf(stderr, "FATAL: Out of memory in the reference engine\n");
+			exit(ERR_OUT_OF_MEMORY);
+		}
+
+		memset(reference->arrays + reference->capacity, 0, (capacity - reference->capacity) * sizeof(uint32_t*));
+		memset(reference->sizes + reference->capacity, 0, (capacity - reference->capacity) * sizeof(uint32_t));
+		reference->capacity = capacity;
+	}
+
+	uint64_t old_bytes = (uint64_t)reference->sizes[index] * sizeof(uint32_t);
+	uint64_t new_bytes = (uint64_t)size * sizeof(uint32_t);
+
+	if (reference->live_bytes - old_bytes + new_bytes > FUZZ_MEMORY_LIMIT)
+		return 0;
+
+	free(reference->arrays[index]);
+	reference->arrays[index] = (uint32_t*)calloc((size_t)size + 1, sizeof(uint32_t));
+
+	if (reference->arrays[index] == NULL)
+	{
+		fprintf(stderr, "FATAL: Out of memory in the reference engine\n");
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	reference->sizes[index] = size;
+	reference->live_bytes += new_bytes - old_bytes;
+
+	return 1;
+}
+
+void reference_free(Reference* reference)
+{
+	uint32_t i;
+	for (i = 0; i < reference->capacity; i++)
+		free(reference->arrays[i]);
+
+	free(reference->arrays);
+	free(reference->sizes);
+	free(reference->abandoned);
+}
+
+/**
+ * Runs the machine as any host would, isolated and with
+ * the budget enforced through on_event.
+ */
+
+void run_machine(Machine* machine, const uint32_t* platters, uint32_t count, const uint8_t* input, size_t input_size, Outcome* outcome)
+{
+	FuzzInput io = { input, input_size, 0, &outcome->output };
+
+	memset(outcome, 0, sizeof(Outcome));
+
+	machine_init(machine);
+	machine_load_program(machine, platters, count);
+
+	machine->isolated = 1;
+	machine->memory->limit = FUZZ_MEMORY_LIMIT;
+	machine->context = &io;
+	machine->read_byte = fuzz_read_byte;
+	machine->write_byte = fuzz_write_byte;
+	machine->on_event = fuzz_out_of_budget;
+	machine->next_event = budget;
+
+	MachineStatus status = machine_run(machine);
+
+	if (status == MACHINE_HALTED)
+		outcome->status = OUTCOME_HALTED;
+	else if (status == MACHINE_PREEMPTED)
+		outcome->status = OUTCOME_OUT_OF_BUDGET;
+	else
+		outcome->status = OUTCOME_FAILED;
+
+	outcome->cycles = machine->cycle;
+	memcpy(outcome->registers, machine->registers, sizeof(outcome->registers));
+}
+
+int fuzz_read_byte(Machine* machine)
+{
+	FuzzInput* io = (FuzzInput*)machine->context;
+
+	return io->position < io->size ? io->bytes[io->position++] : EOF;
+}
+
+void fuzz_write_byte(Machine* machine, uint8_t byte)
+{
+	FuzzInput* io = (FuzzInput*)machine->context;
+
+	append_byte(io->output, byte);
+}
+
+void fuzz_out_of_budget(Machine* machine)
+{
+	machine_stop(machine, MACHINE_PREEMPTED);
+}
+
+/**
+ * Outputs and statuses must always match. Unless the run
+ * failed, where the spec says nothing about the state left
+ * behind, so must the cycles, the registers and the arrays.
+ */
+
+int compare_outcomes(Outcome* expected, Outcome* actual, Reference* reference, Machine* machine, char* report)
+{
+	if (expected->status != actual->status)
+	{
+		snprintf(report, MAX_REPORT, "the reference %s after %llu cycles, the machine %s after %llu",
+			outcome_names[expected->status], (unsigned long long)expected->cycles,
+			outcome_names[actual->status], (unsigned long long)actual->cycles
+		);
+
+		return 1;
+	}
+
+	if (expected->output.size != actual->output.size || memcmp(expected->output.data, actual->output.data, expected->output.size) != 0)
+	{
+		snprintf(report, MAX_REPORT, "the outputs differ, %zu bytes from the reference, %zu from the machine",
+			expected->output.size, actual->output.size
+		);
+
+		return 1;
+	}
+
+	if (expected->status == OUTCOME_FAILED)
+		return 0;
+
+	if (expected->cycles != actual->cycles)
+	{
+		snprintf(report, MAX_REPORT, "%llu cycles for the reference, %llu for the machine",
+			(unsigned long long)expected->cycles, (unsigned long long)actual->cycles
+		);
+
+		return 1;
+	}
+
+	uint8_t i;
+	for (i = 0; i < REGISTERS_COUNT; i++)
+	{
+		if (expected->registers[i] != actual->registers[i])
+		{
+			snprintf(report, MAX_REPORT, "r%u is %u for the reference, %u for the machine", i, expected->registers[i], actual->registers[i]);
+			return 1;
+		}
+	}
+
+	uint32_t count = reference->count > machine->memory->size ? reference->count : machine->memory->size;
+	uint32_t index;
+
+	for (index = 0; index < count; index++)
+	{
+		int expected_active = index < reference->count && reference->arrays[index] != NULL;
+		int actual_active = index < machine->memory->size && machine->memory->arrays[index].content != NULL;
+
+		if (expected_active != actual_active)
+		{
+			snprintf(report, MAX_REPORT, "array %u is %s for the reference but not for the machine", index, expected_active ? "active" : "inactive");
+			return 1;
+		}
+
+		if (!expected_active)
+			continue;
+
+		Array* array = &machine->memory->arrays[index];
+
+		if (reference->sizes[index] != array->size || memcmp(reference->arrays[index], array->content, array->size * sizeof(uint32_t)) != 0)
+		{
+			snprintf(report, MAX_REPORT, "the contents of array %u differ", index);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void append_byte(Buffer* buffer, uint8_t byte)
+{
+	if (buffer->size == buffer->capacity)
+	{
+		buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 64;
+		buffer->data = (uint8_t*)realloc(buffer->data, buffer->capacity);
+
+		if (buffer->data == NULL)
+		{
+			fprintf(stderr, "FATAL: Out of memory for the output\n");
+			exit(ERR_OUT_OF_MEMORY);
+		}
+	}
+
+	buffer->data[buffer->size++] = byte;
+}
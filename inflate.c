@@ -0,0 +1,479 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+#include "inflate.h"
+
+#define MAX_BITS 15
+#define MAX_LITERALS 288
+#define MAX_DISTANCES 30
+#define MAX_CODES (MAX_LITERALS + MAX_DISTANCES)
+#define END_OF_BLOCK 256
+
+#define GZIP_DEFLATE 8
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+/**
+ * A canonical Huffman code, as the number of codes of each
+ * length and the symbols ordered by code.
+ */
+
+typedef struct Huffman {
+	uint16_t	counts[MAX_BITS + 1];
+	uint16_t	symbols[MAX_LITERALS];
+} Huffman;
+
+/**
+ * Decompression state. Errors unwind straight to gunzip
+ * through error, the output growing geometrically.
+ */
+
+typedef struct Inflater {
+	const uint8_t*	in;
+	size_t		in_size;
+	size_t		in_position;
+	uint32_t	bit_buffer;
+	int		bit_count;
+	uint8_t*	out;
+	size_t		out_size;
+	size_t		out_capacity;
+	jmp_buf		error;
+} Inflater;
+
+static const uint16_t length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t distance_base[MAX_DISTANCES] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t distance_extra[MAX_DISTANCES] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// Order in which the lengths of the code lengths code are sent
+
+static const uint8_t code_length_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static uint32_t bits(Inflater* state, int count)
+{
+	uint32_t value = state->bit_buffer;
+
+	while (state->bit_count < count)
+	{
+		if (state->in_position == state->in_size)
+			longjmp(state->error, INFLATE_TRUNCATED);
+
+		value |= (uint32_t)state->in[state->in_position++] << state->bit_count;
+		state->bit_count += 8;
+	}
+
+	state->bit_buffer = count < 32 ? value >> count : 0;
+	state->bit_count -= count;
+
+	return value & (((uint32_t)1 << count) - 1);
+}
+
+static void put_byte(Inflater* state, uint8_t byte)
+{
+	if (state->out_size == state->out_capacity)
+	{
+		size_t capacity = state->out_capacity ? state->out_capacity * 2 : 1 << 16;
+		uint8_t* out = (uint8_t*)realloc(state->out, capacity);
+
+		if (out == NULL)
+			longjmp(state->error, INFLATE_OUT_OF_MEMORY);
+
+		state->out = out;
+		state->out_capacity = capacity;
+	}
+
+	state->out[state->out_size++] = byte;
+}
+
+/**
+ * Builds a code from the length of the code of each
+ * symbol, failing if it has more codes than lengths allow.
+ * Incomplete codes are accepted, as a single distance
+ * code is legal.
+ */
+
+static void build(Inflater* state, Huffman* code, const uint8_t* lengths, int count)
+{
+	uint16_t offsets[MAX_BITS + 1];
+	int length;
+	int symbol;
+	int left = 1;
+
+	memset(code->counts, 0, sizeof(code->counts));
+
+	for (symbol = 0; symbol < count; symbol++)
+		code->counts[lengths[symbol]]++;
+
+	for (length = 1; length <= MAX_BITS; length++)
+	{
+		left = (left << 1) - code->counts[length];
+
+		if (left < 0)
+			longjmp(state->error, INFLATE_INVALID);
+	}
+
+	offsets[1] = 0;
+
+	for (length = 1; length < MAX_BITS; length++)
+		offsets[length + 1] = offsets[length] + code->counts[length];
+
+	for (symbol = 0; symbol < count; symbol++)
+	{
+		if (lengths[symbol])
+			code->symbols[offsets[lengths[symbol]]++] = symbol;
+	}
+}
+
+/**
+ * Reads a symbol bit by bit, codes being packed starting
+ * with their most significant bit.
+ */
+
+static int decode(Inflater* state, const Huffman* code)
+{
+	int value = 0;
+	int first = 0;
+	int index = 0;
+	int length;
+
+	for (length = 1; length <= MAX_BITS; length++)
+	{
+		value |= bits(state, 1);
+
+		int count = code->counts[length];
+
+		if (value - count < first)
+			return code->symbols[index + (value - first)];
+
+		index += count;
+		first = (first + count) << 1;
+		value <<= 1;
+	}
+
+	longjmp(state->error, INFLATE_INVALID);
+}
+
+static void inflate_stored(Inflater* state)
+{
+	state->bit_buffer = 0;
+	state->bit_count = 0;
+
+	if (state->in_size - state->in_position < 4)
+		longjmp(state->error, INFLATE_TRUNCATED);
+
+	const uint8_t* header = state->in + state->in_position;
+	uint32_t length = header[0] | (header[1] << 8);
+
+	if ((header[2] | (header[3] << 8)) != (~length & 0xFFFF))
+		longjmp(state->error, INFLATE_INVALID);
+
+	state->in_position += 4;
+
+	if (state->in_size - state->in_position < length)
+		longjmp(state->error, INFLATE_TRUNCATED);
+
+	while (length--)
+		put_byte(state, state->in[state->in_position++]);
+}
+
+static void inflate_codes(Inflater* state, const Huffman* literals, const Huffman* distances)
+{
+	int symbol;
+
+	while ((symbol = decode(state, literals)) != END_OF_BLOCK)
+	{
+		if (symbol < END_OF_BLOCK)
+		{
+			put_byte(state, symbol);
+			continue;
+		}
+
+		symbol -= END_OF_BLOCK + 1;
+
+		if (symbol >= 29)
+			longjmp(state->error, INFLATE_INVALID);
+
+		size_t length = length_base[symbol] + bits(state, length_extra[symbol]);
+
+		symbol = decode(state, distances);
+
+		if (symbol >= MAX_DISTANCES)
+			longjmp(state->error, INFLATE_INVALID);
+
+		size_t distance = distance_base[symbol] + bits(state, distance_extra[symbol]);
+
+		if (distance > state->out_size)
+			longjmp(state->error, INFLATE_INVALID);
+
+		// Byte by byte, as a copy may overlap what it produces
+
+		while (length--)
+			put_byte(state, state->out[state->out_size - distance]);
+	}
+}
+
+static void inflate_fixed(Inflater* state)
+{
+	uint8_t lengths[MAX_LITERALS];
+	Huffman literals;
+	Huffman distances;
+	int symbol;
+
+	for (symbol = 0; symbol < 144; symbol++)
+		lengths[symbol] = 8;
+	for (; symbol < 256; symbol++)
+		lengths[symbol] = 9;
+	for (; symbol < 280; symbol++)
+		lengths[symbol] = 7;
+	for (; symbol < MAX_LITERALS; symbol++)
+		lengths[symbol] = 8;
+
+	build(state, &literals, lengths, MAX_LITERALS);
+
+	for (symbol = 0; symbol < MAX_DISTANCES; symbol++)
+		lengths[symbol] = 5;
+
+	build(state, &distances, lengths, MAX_DISTANCES);
+	inflate_codes(state, &literals, &distances);
+}
+
+static void inflate_dynamic(Inflater* state)
+{
+	uint8_t lengths[MAX_CODES];
+	Huffman literals;
+	Huffman distances;
+
+	int literals_count = bits(state, 5) + 257;
+	int distances_count = bits(state, 5) + 1;
+	int code_lengths_count = bits(state, 4) + 4;
+
+	if (literals_count > MAX_LITERALS || distances_count > MAX_DISTANCES)
+		longjmp(state->error, INFLATE_INVALID);
+
+	int index;
+
+	memset(lengths, 0, sizeof(lengths));
+
+	for (index = 0; index < code_lengths_count; index++)
+		lengths[code_length_order[index]] = bits(state, 3);
+
+	build(state, &literals, lengths, 19);
+
+	index = 0;
+
+	while (index < literals_count + distances_count)
+	{
+		int symbol = decode(state, &literals);
+		int repeat;
+		uint8_t length = 0;
+
+		if (symbol < 16)
+		{
+			lengths[index++] = symbol;
+			continue;
+		}
+
+		if (symbol == 16)
+		{
+			if (index == 0)
+				longjmp(state->error, INFLATE_INVALID);
+
+			length = lengths[index - 1];
+			repeat = 3 + bits(state, 2);
+		}
+		else if (symbol == 17)
+		{
+			repeat = 3 + bits(state, 3);
+		}
+		else
+		{
+			repeat = 11 + bits(state, 7);
+		}
+
+		if (index + repeat > literals_count + distances_count)
+			longjmp(state->error, INFLATE_INVALID);
+
+		while (repeat--)
+			lengths[index++] = length;
+	}
+
+	if (lengths[END_OF_BLOCK] == 0)
+		longjmp(state->error, INFLATE_INVALID);
+
+	build(state, &literals, lengths, literals_count);
+	build(state, &distances, lengths + literals_count, distances_count);
+	inflate_codes(state, &literals, &distances);
+}
+
+static void inflate_blocks(Inflater* state)
+{
+	int last;
+
+	do
+	{
+		last = bits(state, 1);
+
+		switch (bits(state, 2))
+		{
+			case 0: inflate_stored(state); break;
+			case 1: inflate_fixed(state); break;
+			case 2: inflate_dynamic(state); break;
+			default: longjmp(state->error, INFLATE_INVALID);
+		}
+	}
+	while (!last);
+
+	// Members start on a byte boundary
+
+	state->bit_buffer = 0;
+	state->bit_count = 0;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* bytes, size_t size)
+{
+	static uint32_t table[256];
+	static int ready = 0;
+
+	if (!ready)
+	{
+		uint32_t n;
+		for (n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			int k;
+
+			for (k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+
+			table[n] = c;
+		}
+
+		ready = 1;
+	}
+
+	crc = ~crc;
+
+	while (size--)
+		crc = table[(crc ^ *bytes++) & 0xFF] ^ (crc >> 8);
+
+	return ~crc;
+}
+
+static uint32_t read_le32(Inflater* state)
+{
+	if (state->in_size - state->in_position < 4)
+		longjmp(state->error, INFLATE_TRUNCATED);
+
+	const uint8_t* bytes = state->in + state->in_position;
+	state->in_position += 4;
+
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static void skip_header(Inflater* state)
+{
+	if (state->in_size - state->in_position < 10)
+		longjmp(state->error, INFLATE_TRUNCATED);
+
+	const uint8_t* header = state->in + state->in_position;
+
+	if (header[0] != GZIP_ID1 || header[1] != GZIP_ID2 || header[2] != GZIP_DEFLATE)
+		longjmp(state->error, INFLATE_INVALID);
+
+	uint8_t flags = header[3];
+	state->in_position += 10;
+
+	if (flags & GZIP_FEXTRA)
+	{
+		if (state->in_size - state->in_position < 2)
+			longjmp(state->error, INFLATE_TRUNCATED);
+
+		size_t length = state->in[state->in_position] | (state->in[state->in_position + 1] << 8);
+		state->in_position += 2 + length;
+	}
+
+	if (flags & GZIP_FNAME)
+	{
+		while (state->in_position < state->in_size && state->in[state->in_position])
+			state->in_position++;
+
+		state->in_position++;
+	}
+
+	if (flags & GZIP_FCOMMENT)
+	{
+		while (state->in_position < state->in_size && state->in[state->in_position])
+			state->in_position++;
+
+		state->in_position++;
+	}
+
+	if (flags & GZIP_FHCRC)
+		state->in_position += 2;
+
+	if (state->in_position > state->in_size)
+		longjmp(state->error, INFLATE_TRUNCATED);
+}
+
+/**
+ * Decompresses a gzip file, made of one or more members,
+ * checking the CRC and size of each of them. On success,
+ * out holds the malloc'd content.
+ */
+
+int gunzip(const uint8_t* in, size_t in_size, uint8_t** out, size_t* out_size)
+{
+	Inflater state;
+	memset(&state, 0, sizeof(Inflater));
+	state.in = in;
+	state.in_size = in_size;
+
+	int code = setjmp(state.error);
+
+	if (code)
+	{
+		free(state.out);
+		return code;
+	}
+
+	do
+	{
+		size_t start = state.out_size;
+
+		skip_header(&state);
+		inflate_blocks(&state);
+
+		uint32_t crc = read_le32(&state);
+		uint32_t size = read_le32(&state);
+
+		if (crc != crc32(0, state.out + start, state.out_size - start) || size != (uint32_t)(state.out_size - start))
+			longjmp(state.error, INFLATE_INVALID);
+	}
+	while (state.in_position < state.in_size);
+
+	*out = state.out;
+	*out_size = state.out_size;
+
+	return INFLATE_OK;
+}
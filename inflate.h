@@ -0,0 +1,17 @@
+#if !defined(__INFLATE_H)
+#define __INFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GZIP_ID1 0x1F
+#define GZIP_ID2 0x8B
+
+#define INFLATE_OK 0
+#define INFLATE_TRUNCATED -1
+#define INFLATE_INVALID -2
+#define INFLATE_OUT_OF_MEMORY -3
+
+int gunzip(const uint8_t* in, size_t in_size, uint8_t** out, size_t* out_size);
+
+#endif /* __INFLATE_H */
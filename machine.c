@@ -0,0 +1,2126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "error_codes.h"
+#include "machine.h"
+#include "codecache.h"
+#include "inflate.h"
+
+#define GET_REGISTERS_COUNT(var, extra) \
+	uint8_t var;\
+	\
+	if (!extra)\
+		var = REGISTERS_COUNT;\
+	else\
+		var = REGISTERS_COUNT + EXTRA_REGISTERS\
+
+#ifdef DEBUG
+#define TRACE(...) printf( __VA_ARGS__)
+#else
+#define TRACE(...) 0
+#endif
+
+void conditional_move(uint32_t op, Machine* machine);
+void array_index(uint32_t op, Machine* machine);
+void array_amendment(uint32_t op, Machine* machine);
+void addition(uint32_t op, Machine* machine);
+void multiplication(uint32_t op, Machine* machine);
+void division(uint32_t op, Machine* machine);
+void not_and(uint32_t op, Machine* machine);
+void halt(uint32_t op, Machine* machine);
+void allocation(uint32_t op, Machine* machine);
+void abandoment(uint32_t op, Machine* machine);
+void output(uint32_t op, Machine* machine);
+void input(uint32_t op, Machine* machine);
+void load_program(uint32_t op, Machine* machine);
+void ortography(uint32_t op, Machine* machine);
+void invalid_operation(uint32_t op, Machine* machine);
+void breakpoint(uint32_t op, Machine* machine);
+void watched_amendment(uint32_t op, Machine* machine);
+void output_run(uint32_t op, Machine* machine);
+
+static inline void decode_instruction(Instruction* instruction, uint32_t platter);
+static void patch_instruction(uint32_t pc, Machine* machine);
+static OutputRun* find_output_run(uint32_t pc, Machine* machine);
+static void break_output_run(uint32_t location, Machine* machine);
+static void write_bytes(Machine* machine, const uint8_t* bytes, uint32_t count);
+static void amend_program(uint32_t location, uint32_t value, Machine* machine);
+static void grow_shared_table(uint32_t size, Machine* machine);
+static void reschedule_events(Machine* machine);
+static int console_read_byte(Machine* machine);
+static void console_write_byte(Machine* machine, uint8_t byte);
+
+#ifdef SPECIALIZED_HANDLERS
+#include "specialized.h"
+#endif
+
+void (*opcodes_table[HANDLERS_COUNT]) (uint32_t, Machine*) = {
+	conditional_move,
+	array_index,
+	array_amendment,
+	addition,
+	multiplication,
+	division,
+	not_and,
+	halt,
+	allocation,
+	abandoment,
+	output,
+	input,
+	load_program,
+	ortography,
+	invalid_operation,
+	breakpoint,
+	watched_amendment,
+	output_run,
+	#ifdef SPECIALIZED_HANDLERS
+	SPECIALIZED_HANDLERS_TABLE
+	#endif
+};
+
+/**
+ * Prepares an empty machine talking to the console.
+ */
+
+void machine_init(Machine* machine)
+{
+	memset((void*)machine, 0, sizeof(Machine));
+
+	initialize_memory(machine);
+
+	machine->status = MACHINE_RUNNING;
+	machine->next_event = EVENTS_POLL_INTERVAL;
+	machine->read_byte = console_read_byte;
+	machine->write_byte = console_write_byte;
+}
+
+void machine_free(Machine* machine)
+{
+	uint32_t i;
+	for (i = 0; i < machine->memory->size; i++)
+		free(machine->memory->arrays[i].content);
+
+	for (i = 0; i < machine->memory->retired_count; i++)
+		free(machine->memory->retired[i]);
+
+	if (machine->memory->shared)
+		pthread_mutex_destroy(&machine->memory->lock);
+
+	free(machine->memory->arrays);
+	free(machine->memory->pool);
+	free(machine->memory->retired);
+	free(machine->memory);
+	free(machine->profile);
+	free(machine->breakpoints);
+	free(machine->watchpoints);
+	release_code(machine);
+
+	machine->memory = NULL;
+	machine->profile = NULL;
+	machine->breakpoints = NULL;
+	machine->breakpoints_count = 0;
+	machine->watchpoints = NULL;
+	machine->watchpoints_count = 0;
+}
+
+/**
+ * Replaces the '0' array with count platters, already
+ * in host order.
+ */
+
+void machine_load_program(Machine* machine, const uint32_t* platters, uint32_t count)
+{
+	allocate_memory(PROGRAM_ARRAY, count, machine);
+	memcpy(get_array(PROGRAM_ARRAY, machine)->content, platters, count * sizeof(uint32_t));
+	decode_program(machine);
+}
+
+/**
+ * Reads a whole stream, which doesn't have to be seekable,
+ * into a buffer growing geometrically.
+ */
+
+static uint8_t* read_stream(FILE* in, size_t* size)
+{
+	size_t capacity = 1 << 16;
+	uint8_t* bytes = (uint8_t*)malloc(capacity);
+
+	*size = 0;
+
+	while (bytes != NULL)
+	{
+		*size += fread(bytes + *size, 1, capacity - *size, in);
+
+		if (*size < capacity)
+			break;
+
+		capacity *= 2;
+		uint8_t* grown = (uint8_t*)realloc(bytes, capacity);
+
+		if (grown == NULL)
+			free(bytes);
+
+		bytes = grown;
+	}
+
+	if (bytes == NULL || ferror(in))
+	{
+		free(bytes);
+		return NULL;
+	}
+
+	return bytes;
+}
+
+/**
+ * Loads a program image, made of big-endian platters,
+ * into the '0' array. The image is read from a file, or
+ * from the standard input when filename is "-", and may be
+ * compressed with gzip. With a code cache, the decoded
+ * program is mapped from the entry of an identical image
+ * when there's one, and stored for the next runs otherwise.
+ */
+
+void machine_load_file(Machine* machine, const char* filename)
+{
+	FILE* program_file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+
+	if (program_file == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't open program file: %s\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	size_t fsize = 0;
+	uint8_t* bytes = read_stream(program_file, &fsize);
+
+	if (bytes == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't read program file: %s\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	if (program_file != stdin)
+		fclose(program_file);
+
+	if (fsize >= 4 && memcmp(bytes, ZSTD_MAGIC, 4) == 0)
+	{
+		fprintf(stderr, "FATAL: %s is compressed with zstd, which is not supported: decompress it or use gzip\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	if (fsize >= 2 && bytes[0] == GZIP_ID1 && bytes[1] == GZIP_ID2)
+	{
+		uint8_t* image = NULL;
+		int code = gunzip(bytes, fsize, &image, &fsize);
+
+		if (code != INFLATE_OK)
+		{
+			fprintf(stderr, "FATAL: Can't decompress program file: %s (%s)\n", filename,
+				code == INFLATE_TRUNCATED ? "truncated" : code == INFLATE_INVALID ? "corrupted" : "out of memory");
+			exit(code == INFLATE_OUT_OF_MEMORY ? ERR_OUT_OF_MEMORY : ERR_INVALID_PROGRAM_FILE);
+		}
+
+		free(bytes);
+		bytes = image;
+	}
+
+	if (fsize % sizeof(uint32_t) != 0)
+	{
+		fprintf(stderr, "FATAL: program file %s holds %zu bytes, which is not a whole number of platters\n", filename, fsize);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	if (fsize / sizeof(uint32_t) > UINT32_MAX)
+	{
+		fprintf(stderr, "FATAL: program file %s is too big\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	uint32_t count = fsize / sizeof(uint32_t);
+
+	allocate_memory(PROGRAM_ARRAY, count, machine);
+	platters_from_big_endian(get_array(PROGRAM_ARRAY, machine)->content, bytes, count);
+
+	if (machine->code_cache != NULL)
+	{
+		uint64_t hash = code_hash(bytes, count * sizeof(uint32_t));
+		size_t mapped = 0;
+		Instruction* code = code_cache_map(machine->code_cache, hash, count, &mapped);
+
+		release_code(machine);
+
+		if (code != NULL)
+		{
+			machine->code = code;
+			machine->code_size = count;
+			machine->code_mapped = mapped;
+			fuse_output_runs(machine);
+		}
+		else
+		{
+			decode_program(machine);
+			code_cache_store(machine->code_cache, hash, machine->code, count);
+		}
+	}
+	else
+	{
+		decode_program(machine);
+	}
+
+	free(bytes);
+}
+
+/**
+ * Runs the machine until it halts, fails, waits for input
+ * or is stopped by on_event. Everything that makes it leave
+ * the loop goes through machine_stop, which schedules an
+ * event on the next cycle: the loop itself only compares
+ * cycle with next_event.
+ */
+
+MachineStatus machine_run(Machine* machine)
+{
+	Instruction* instruction;
+	jmp_buf trap;
+
+	if (machine->isolated)
+	{
+		int code = setjmp(trap);
+
+		if (code)
+		{
+			fprintf(stderr, "ERROR: machine failed with error %d at cycle %llu\n", code, (unsigned long long)machine->cycle);
+			machine->trap = NULL;
+			machine->status = MACHINE_FAILED;
+			return machine->status;
+		}
+
+		machine->trap = &trap;
+	}
+
+	machine->status = MACHINE_RUNNING;
+	reschedule_events(machine);
+
+	if (machine->status != MACHINE_RUNNING)
+	{
+		machine->trap = NULL;
+		return machine->status;
+	}
+
+	for(;;)
+	{
+		uint32_t pc = peek(&instruction, machine);
+
+		if (machine->profile != NULL)
+			profile_instruction(pc, machine);
+
+		// Traced before being executed, so that an operation
+		// ending the process still makes it to the trace
+
+		if (machine->trace != NULL)
+			trace_operation(pc, instruction->platter, machine);
+
+		opcodes_table[instruction->handler](instruction->platter, machine);
+
+		if (machine->trace != NULL)
+			trace_result(machine);
+
+		machine->cycle++;
+
+		if (machine->cycle == machine->next_event)
+		{
+			if (machine->status == MACHINE_RUNNING)
+			{
+				if (machine->on_event != NULL)
+					machine->on_event(machine);
+				else
+					machine->next_event = machine->cycle + EVENTS_POLL_INTERVAL;
+			}
+
+			if (machine->status != MACHINE_RUNNING)
+			{
+				machine->trap = NULL;
+				return machine->status;
+			}
+		}
+	}
+}
+
+/**
+ * Executes a single operation, even one under a breakpoint
+ * or a watchpoint, which is how execution goes past them.
+ * Returns MACHINE_RUNNING if the machine can go on.
+ */
+
+MachineStatus machine_step(Machine* machine)
+{
+	Instruction* instruction;
+	Instruction original;
+	jmp_buf trap;
+
+	if (machine->isolated)
+	{
+		int code = setjmp(trap);
+
+		if (code)
+		{
+			fprintf(stderr, "ERROR: machine failed with error %d at cycle %llu\n", code, (unsigned long long)machine->cycle);
+			machine->trap = NULL;
+			machine->status = MACHINE_FAILED;
+			return machine->status;
+		}
+
+		machine->trap = &trap;
+	}
+
+	machine->status = MACHINE_RUNNING;
+	reschedule_events(machine);
+
+	if (machine->status != MACHINE_RUNNING)
+	{
+		machine->trap = NULL;
+		return machine->status;
+	}
+
+	uint32_t pc = peek(&instruction, machine);
+	decode_instruction(&original, instruction->platter);
+
+	if (machine->profile != NULL)
+		profile_instruction(pc, machine);
+
+	if (machine->trace != NULL)
+		trace_operation(pc, original.platter, machine);
+
+	opcodes_table[original.handler](original.platter, machine);
+
+	if (machine->trace != NULL)
+		trace_result(machine);
+
+	machine->cycle++;
+
+	if (machine->cycle == machine->next_event && machine->status == MACHINE_RUNNING)
+	{
+		if (machine->on_event != NULL)
+			machine->on_event(machine);
+		else
+			machine->next_event = machine->cycle + EVENTS_POLL_INTERVAL;
+	}
+
+	machine->trap = NULL;
+	return machine->status;
+}
+
+/**
+ * A machine resumed after being stopped, by a breakpoint,
+ * a step or while waiting for input, has its next event
+ * in the past, where the loop would never meet it: it's
+ * serviced now, which schedules the following one.
+ */
+
+static void reschedule_events(Machine* machine)
+{
+	if (machine->next_event > machine->cycle)
+		return;
+
+	if (machine->on_event != NULL)
+		machine->on_event(machine);
+	else
+		machine->next_event = machine->cycle + EVENTS_POLL_INTERVAL;
+}
+
+/**
+ * Clones the machine into a child process, returning like
+ * fork. The arrays are shared copy-on-write by the kernel,
+ * so cloning a large machine costs about as much as its
+ * page tables. The clone is isolated, a failure ending its
+ * run instead of the process with its parent's handlers.
+ */
+
+pid_t machine_fork(Machine* machine)
+{
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t pid = fork();
+
+	if (pid == 0)
+	{
+		machine->isolated = 1;
+
+		// The writer thread of the trace doesn't survive fork
+
+		machine->trace = NULL;
+	}
+
+	return pid;
+}
+
+/**
+ * Makes machine_run return status after the current cycle.
+ */
+
+void machine_stop(Machine* machine, MachineStatus status)
+{
+	machine->status = status;
+	machine->next_event = machine->cycle + 1;
+}
+
+static int console_read_byte(Machine* machine)
+{
+	return getc(stdin);
+}
+
+static void console_write_byte(Machine* machine, uint8_t byte)
+{
+	putchar(byte);
+}
+
+/**
+ * The console takes the bytes in a single write, other
+ * hooks one by one.
+ */
+
+static void write_bytes(Machine* machine, const uint8_t* bytes, uint32_t count)
+{
+	if (machine->write_byte == console_write_byte)
+	{
+		fwrite(bytes, 1, count, stdout);
+		return;
+	}
+
+	uint32_t i;
+	for (i = 0; i < count; i++)
+		machine->write_byte(machine, bytes[i]);
+}
+
+void fatal(int code, Machine* machine)
+{
+	static pthread_mutex_t failing = PTHREAD_MUTEX_INITIALIZER;
+
+	if (machine->trap != NULL)
+		longjmp(*machine->trap, code);
+
+	// Of the machines of a threaded program failing at once,
+	// the first one dumps the memory and ends the process
+
+	pthread_mutex_lock(&failing);
+
+	#ifndef DISABLE_MEMORY_DUMP
+		dump_memory(machine);
+	#endif
+
+	exit(code);
+}
+
+void initialize_memory(Machine* machine)
+{
+	machine->memory = (Memory*)calloc(1, sizeof(Memory));
+
+	if (machine->memory == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating memory\n");
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+
+	machine->memory->arrays = (Array*)malloc(sizeof(Array));
+
+	#ifndef UNSAFE
+	if (machine->memory->arrays == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating memory pointers\n");
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+	#endif
+
+	machine->memory->pool = (uint32_t*)malloc(sizeof(uint32_t));
+
+	#ifndef UNSAFE
+	if (machine->memory->pool == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating memory pool\n");
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+	#endif
+
+	memset(machine->memory->pool, 0, sizeof(uint32_t));
+	memset(machine->memory->arrays, 0, sizeof(Array));
+	machine->memory->pool_pointer = 0;
+}
+
+/**
+ * Prepares the memory to be shared by machines running in
+ * other threads, which only take the lock to allocate and
+ * abandon arrays.
+ */
+
+void share_memory(Machine* machine)
+{
+	Memory* memory = machine->memory;
+
+	if (memory->shared)
+		return;
+
+	pthread_mutex_init(&memory->lock, NULL);
+	memory->capacity = memory->size;
+	memory->machines = 1;
+	memory->shared = 1;
+}
+
+void allocate_memory(uint32_t index, uint32_t size, Machine* machine)
+{
+	if (machine->memory->size < (index + 1) && machine->memory->shared)
+	{
+		grow_shared_table(index + 1, machine);
+
+		uint32_t i;
+		for(i = machine->memory->size; i < index + 1; i++)
+		{
+			machine->memory->arrays[i].content = NULL;
+			machine->memory->arrays[i].size = 0;
+		}
+
+		__atomic_store_n(&machine->memory->size, index + 1, __ATOMIC_RELEASE);
+	}
+	else if (machine->memory->size < (index + 1))
+	{
+		TRACE("memory needs to be resized from %u to %u\n", machine->memory->size, (index + 1));
+		machine->memory->arrays = (Array*)realloc(machine->memory->arrays, (index + 1) * sizeof(Array));
+		machine->memory->pool = (uint32_t*)realloc(machine->memory->pool, (index + 1) * sizeof(uint32_t));
+
+		#ifndef UNSAFE
+		if (machine->memory->arrays == NULL || machine->memory->pool == NULL)
+		{
+			fprintf(stderr, "FATAL: Error resizing memory pointers while "
+				"allocating array %d with size of %d bytes\n", index, size);
+
+			fatal(ERR_OUT_OF_MEMORY, machine);
+		}
+		#endif
+
+		uint32_t i;
+		for(i = machine->memory->size; i < index + 1; i++)
+		{
+			TRACE("initializing unallocated array %u\n", i);
+			machine->memory->arrays[i].content = NULL;
+			machine->memory->arrays[i].size = 0;
+		}
+
+		machine->memory->size = index + 1;
+	}
+
+	Array* array = &machine->memory->arrays[index];
+	uint64_t old_bytes = array->content != NULL ? (uint64_t)array->size * sizeof(uint32_t) : 0;
+	uint64_t new_bytes = (uint64_t)size * sizeof(uint32_t);
+
+	if (machine->memory->limit && machine->memory->live_bytes - old_bytes + new_bytes > machine->memory->limit)
+	{
+		fprintf(stderr, "FATAL: allocating array %u with size of %u platters exceeds the memory limit of %llu bytes\n",
+			index, size, (unsigned long long)machine->memory->limit
+		);
+
+		write_memory_stats(machine, stderr);
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+
+	if (array->content == NULL)
+	{
+		uint8_t bucket = 0;
+
+		while (bucket < HISTOGRAM_BUCKETS - 1 && ((uint64_t)1 << bucket) <= size)
+			bucket++;
+
+		machine->memory->live_arrays++;
+		machine->memory->allocations++;
+		machine->memory->histogram[bucket]++;
+
+		if (machine->memory->live_arrays > machine->memory->peak_arrays)
+			machine->memory->peak_arrays = machine->memory->live_arrays;
+	}
+
+	machine->memory->live_bytes += new_bytes - old_bytes;
+
+	if (machine->memory->live_bytes > machine->memory->peak_bytes)
+		machine->memory->peak_bytes = machine->memory->live_bytes;
+
+	if (machine->memory->arrays[index].content == NULL)
+	{
+		machine->memory->arrays[index].content = (uint32_t*)malloc(size * sizeof(uint32_t));
+
+		#ifndef UNSAFE
+		if (!machine->memory->arrays[index].content)
+		{
+			fprintf(stderr, "FATAL: Error allocating array %d with size of %d bytes\n", index, size);
+			fatal(ERR_OUT_OF_MEMORY, machine);
+		}
+		#endif
+	}
+	else
+	{
+		machine->memory->arrays[index].content = (uint32_t*)realloc(machine->memory->arrays[index].content, size * sizeof(uint32_t));
+
+		#ifndef UNSAFE
+		if (!machine->memory->arrays[index].content)
+		{
+			fprintf(stderr, "FATAL: Error resizing array %d with size of %d bytes\n", index, size);
+			fatal(ERR_OUT_OF_MEMORY, machine);
+		}
+		#endif
+	}
+
+	memset((void*)machine->memory->arrays[index].content, 0, (size_t)(size * sizeof(uint32_t)));
+	machine->memory->arrays[index].size = size;
+
+	TRACE("allocate_memory(index = %u, size = %u)\n", index, size);
+}
+
+Array* get_array(uint32_t index, Machine* machine)
+{
+	// Acquiring the size makes a machine seeing an array
+	// allocated by another thread also see the table holding it
+
+	#ifndef UNSAFE
+	if ((__atomic_load_n(&machine->memory->size, __ATOMIC_ACQUIRE) - 1) < index)
+	{
+		fprintf(stderr, "FATAL: Error accessing unallocated array at index %d. Last index is %d.\n", index, machine->memory->size - 1);
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+	#endif
+
+	return &machine->memory->arrays[index];
+}
+
+uint32_t read_array(uint32_t index, uint32_t location, Machine* machine)
+{
+	Array* array = get_array(index, machine);
+
+	#ifndef UNSAFE
+	if (location >= array->size)
+	{
+		fprintf(stderr, "FATAL: reading array %u at %u, which is beyond its last index %u.\n", index, location, array->size - 1);
+		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+	}
+	#endif
+
+	return array->content[location];
+}
+
+/**
+ * Stores value in an array, decoding it again when the
+ * program amends its own code.
+ */
+
+void write_array(uint32_t index, uint32_t location, uint32_t value, Machine* machine)
+{
+	Array* array = get_array(index, machine);
+
+	#ifndef UNSAFE
+	if (location >= array->size)
+	{
+		fprintf(stderr, "FATAL: trying to set value of array %u at %u, beyond its last index %d.\n",
+			index, location, array->size - 1
+		);
+
+		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+	}
+
+	// The other machines execute the decoded '0' array, whose
+	// instructions can't be replaced under them at once
+
+	if (index == PROGRAM_ARRAY && machine->memory->machines > 1)
+	{
+		fprintf(stderr, "FATAL: amending the '0' array while %u machines are running.\n", machine->memory->machines);
+		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+	}
+	#endif
+
+	array->content[location] = value;
+
+	if (index == PROGRAM_ARRAY)
+		amend_program(location, value, machine);
+}
+
+/**
+ * Replaces a platter with value if it holds expected,
+ * atomically for the machines sharing the memory. Returns
+ * the value the platter held, expected if it was replaced.
+ */
+
+uint32_t compare_and_swap_array(uint32_t index, uint32_t location, uint32_t expected, uint32_t value, Machine* machine)
+{
+	Array* array = get_array(index, machine);
+
+	#ifndef UNSAFE
+	if (location >= array->size)
+	{
+		fprintf(stderr, "FATAL: trying to compare and swap array %u at %u, beyond its last index %d.\n",
+			index, location, array->size - 1
+		);
+
+		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+	}
+
+	if (index == PROGRAM_ARRAY && machine->memory->machines > 1)
+	{
+		fprintf(stderr, "FATAL: amending the '0' array while %u machines are running.\n", machine->memory->machines);
+		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+	}
+	#endif
+
+	if (__atomic_compare_exchange_n(&array->content[location], &expected, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+		&& index == PROGRAM_ARRAY)
+	{
+		amend_program(location, value, machine);
+	}
+
+	return expected;
+}
+
+/**
+ * Decodes an amended platter of the '0' array again.
+ */
+
+static void amend_program(uint32_t location, uint32_t value, Machine* machine)
+{
+	if (machine->output_runs_count)
+		break_output_run(location, machine);
+
+	decode_instruction(&machine->code[location], value);
+
+	if (machine->breakpoints_count || machine->watchpoints_count)
+		patch_instruction(location, machine);
+}
+
+/**
+ * Moves the arrays of a shared memory to a table of at
+ * least size entries. Other machines may still be reading
+ * the former one, which is only retired: it's freed with
+ * the memory.
+ */
+
+static void grow_shared_table(uint32_t size, Machine* machine)
+{
+	Memory* memory = machine->memory;
+
+	if (size <= memory->capacity)
+		return;
+
+	uint64_t capacity = (uint64_t)memory->capacity * 2;
+
+	if (capacity < size)
+		capacity = size;
+
+	if (capacity > 0xFFFFFFFF)
+		capacity = 0xFFFFFFFF;
+
+	Array* arrays = (Array*)calloc(capacity, sizeof(Array));
+	Array** retired = (Array**)realloc(memory->retired, (memory->retired_count + 1) * sizeof(Array*));
+	uint32_t* pool = (uint32_t*)realloc(memory->pool, capacity * sizeof(uint32_t));
+
+	if (arrays == NULL || retired == NULL || pool == NULL)
+	{
+		fprintf(stderr, "FATAL: Error resizing the shared memory to %llu arrays\n", (unsigned long long)capacity);
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+
+	memcpy(arrays, memory->arrays, memory->size * sizeof(Array));
+
+	retired[memory->retired_count++] = memory->arrays;
+	memory->retired = retired;
+	memory->pool = pool;
+	memory->capacity = (uint32_t)capacity;
+
+	__atomic_store_n(&memory->arrays, arrays, __ATOMIC_RELEASE);
+}
+
+uint32_t allocate_array(uint32_t size, Machine* machine)
+{
+	uint32_t index = 0;
+
+	if (machine->memory->shared)
+		pthread_mutex_lock(&machine->memory->lock);
+
+	uint64_t live_bytes = machine->memory->live_bytes + (uint64_t)size * sizeof(uint32_t);
+
+	if (machine->memory->gc_threshold && (live_bytes > machine->memory->gc_threshold
+		|| (machine->memory->limit && live_bytes > machine->memory->limit)))
+	{
+		collect_garbage(machine);
+	}
+
+	if (machine->memory->pool_pointer)
+	{
+		index = machine->memory->pool[machine->memory->pool_pointer - 1];
+		TRACE("resurrecting array %u from the pool", index);
+		machine->memory->pool_pointer--;
+	}
+	else
+	{
+		uint32_t i;
+		for(i = 1; i < machine->memory->size; i++)
+		{
+			if (machine->memory->arrays[i].content == NULL)
+			{
+				index = i;
+				break;
+			}
+		}
+	}
+
+	if (!index)
+		index = machine->memory->size;
+
+	TRACE("allocate_array(%u) = %u\n", size, index);
+
+	allocate_memory(index, size, machine);
+
+	if (machine->memory->shared)
+		pthread_mutex_unlock(&machine->memory->lock);
+
+	return index;
+}
+
+uint32_t get_register(uint8_t index, Machine* machine, int allow_extra)
+{
+	GET_REGISTERS_COUNT(max_register, allow_extra);
+
+	#ifndef UNSAFE
+	if (index >= max_register)
+	{
+		fprintf(stderr, "FATAL: trying to get invalid register %d, (extra = %d, last = %d)\n", index, allow_extra, max_register);
+		fatal(ERR_INVALID_REGISTER_ACCESS, machine);
+	}
+	#endif
+
+	return machine->registers[index];
+}
+
+uint32_t set_register(uint8_t index, uint32_t value, Machine* machine, int allow_extra)
+{
+	GET_REGISTERS_COUNT(max_register, allow_extra);
+
+	#ifndef UNSAFE
+	if (index >= max_register)
+	{
+		fprintf(stderr, "FATAL: trying to set invalid register %d", index);
+		fatal(ERR_INVALID_REGISTER_ACCESS, machine);
+	}
+	#endif
+
+	uint32_t old_value = machine->registers[index];
+	machine->registers[index] = value;
+
+	return old_value;
+}
+
+uint32_t peek(Instruction** instruction, Machine* machine)
+{
+	uint32_t pc = get_register(PC_REGISTER, machine, 1);
+
+	#ifndef UNSAFE
+	if (pc >= machine->code_size)
+	{
+		fprintf(stderr, "FATAL: program execution reached the end and no halt operation was encountered\n");
+		fprintf(stderr, "pc = %u, last platter = %u\n", pc, machine->code_size);
+		fatal(ERR_PROGRAM_EXECUTION_ENDED_UNEXPECTEDLY, machine);
+	}
+	#endif
+
+	*instruction = &machine->code[pc];
+
+	return set_register(PC_REGISTER, pc + 1, machine, 1);
+}
+
+/**
+ * Picks the handler of a platter. Specialized handlers,
+ * when built in, have the registers of the operation
+ * baked in: the nine bits holding them are simply added
+ * to the first handler of the operator.
+ */
+
+static inline void decode_instruction(Instruction* instruction, uint32_t platter)
+{
+	uint32_t number = operation_number(platter);
+
+	instruction->platter = platter;
+	instruction->handler = number < OPCODES_COUNT ? number : HANDLER_INVALID;
+
+	#ifdef SPECIALIZED_HANDLERS
+	if (number < SPECIALIZED_OPCODES)
+		instruction->handler = SPECIALIZED_HANDLERS_BASE + (number << 9) + (platter & 0x1FF);
+	else if (number == OPERATION_ORTHOGRAPHY)
+		instruction->handler = SPECIALIZED_PUT_BASE + put_register(platter);
+	#endif
+}
+
+/**
+ * Decodes the whole '0' array again, whenever it's
+ * replaced. Platters amended in place are decoded one
+ * by one by array_amendment.
+ */
+
+void decode_program(Machine* machine)
+{
+	Array* program = get_array(PROGRAM_ARRAY, machine);
+
+	release_code(machine);
+
+	machine->code = (Instruction*)malloc((program->size ? program->size : 1) * sizeof(Instruction));
+
+	if (machine->code == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating the decoded program of %u platters\n", program->size);
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+
+	uint32_t i;
+	for (i = 0; i < program->size; i++)
+		decode_instruction(&machine->code[i], program->content[i]);
+
+	machine->code_size = program->size;
+	fuse_output_runs(machine);
+
+	if (machine->breakpoints_count || machine->watchpoints_count)
+	{
+		for (i = 0; i < program->size; i++)
+			patch_instruction(i, machine);
+	}
+}
+
+/**
+ * Redirects the operation at pc to the handler stopping
+ * the machine when it's under a breakpoint, or to the one
+ * checking the watchpoints when it amends an array.
+ */
+
+static void patch_instruction(uint32_t pc, Machine* machine)
+{
+	Instruction* instruction = &machine->code[pc];
+	OutputRun* run = find_output_run(pc, machine);
+
+	if (run != NULL && run->pc == pc && run->length)
+		instruction->handler = HANDLER_OUTPUT_RUN;
+
+	if (machine->watchpoints_count && operation_number(instruction->platter) == 2)
+		instruction->handler = HANDLER_WATCHED_AMENDMENT;
+
+	uint32_t i;
+	for (i = 0; i < machine->breakpoints_count; i++)
+	{
+		if (machine->breakpoints[i] == pc)
+			instruction->handler = HANDLER_BREAKPOINT;
+	}
+}
+
+/**
+ * Adds or removes a breakpoint, effective even if the
+ * program loads new code at pc later on.
+ */
+
+void machine_set_breakpoint(Machine* machine, uint32_t pc, int enabled)
+{
+	uint32_t i;
+	for (i = 0; i < machine->breakpoints_count && machine->breakpoints[i] != pc; i++);
+
+	if (enabled && i == machine->breakpoints_count)
+	{
+		machine->breakpoints = (uint32_t*)realloc(machine->breakpoints, (i + 1) * sizeof(uint32_t));
+
+		if (machine->breakpoints == NULL)
+		{
+			fprintf(stderr, "FATAL: Error allocating breakpoints\n");
+			exit(ERR_OUT_OF_MEMORY);
+		}
+
+		machine->breakpoints[machine->breakpoints_count++] = pc;
+	}
+	else if (!enabled && i < machine->breakpoints_count)
+	{
+		machine->breakpoints[i] = machine->breakpoints[--machine->breakpoints_count];
+	}
+
+	if (pc < machine->code_size)
+	{
+		decode_instruction(&machine->code[pc], machine->code[pc].platter);
+		patch_instruction(pc, machine);
+	}
+}
+
+/**
+ * Adds or removes a watchpoint on a platter of an array,
+ * or on all of them with WATCH_ANY_OFFSET. While there's
+ * one, every amendment is checked against them.
+ */
+
+void machine_set_watchpoint(Machine* machine, uint32_t array, uint32_t offset, int enabled)
+{
+	uint32_t i;
+	for (i = 0; i < machine->watchpoints_count; i++)
+	{
+		if (machine->watchpoints[i].array == array && machine->watchpoints[i].offset == offset)
+			break;
+	}
+
+	if (enabled && i == machine->watchpoints_count)
+	{
+		machine->watchpoints = (Watchpoint*)realloc(machine->watchpoints, (i + 1) * sizeof(Watchpoint));
+
+		if (machine->watchpoints == NULL)
+		{
+			fprintf(stderr, "FATAL: Error allocating watchpoints\n");
+			exit(ERR_OUT_OF_MEMORY);
+		}
+
+		machine->watchpoints[i].array = array;
+		machine->watchpoints[i].offset = offset;
+		machine->watchpoints_count++;
+	}
+	else if (!enabled && i < machine->watchpoints_count)
+	{
+		machine->watchpoints[i] = machine->watchpoints[--machine->watchpoints_count];
+	}
+
+	for (i = 0; i < machine->code_size; i++)
+	{
+		decode_instruction(&machine->code[i], machine->code[i].platter);
+		patch_instruction(i, machine);
+	}
+}
+
+void release_code(Machine* machine)
+{
+	if (machine->code_mapped)
+		code_cache_unmap(machine->code, machine->code_mapped);
+	else
+		free(machine->code);
+
+	free(machine->output_runs);
+	free(machine->output_bytes);
+
+	machine->code = NULL;
+	machine->code_size = 0;
+	machine->code_mapped = 0;
+	machine->output_runs = NULL;
+	machine->output_runs_count = 0;
+	machine->output_bytes = NULL;
+}
+
+/**
+ * Finds the straight lines of put and output operations
+ * whose bytes only depend on the values put by the line
+ * itself, and has the first operation of each one execute
+ * the whole line. Only the first handler changes, so
+ * jumping into the middle of a run still works.
+ */
+
+void fuse_output_runs(Machine* machine)
+{
+	uint32_t runs_capacity = 0;
+	uint32_t bytes_capacity = 0;
+	uint32_t bytes_count = 0;
+	uint32_t pc = 0;
+
+	free(machine->output_runs);
+	free(machine->output_bytes);
+
+	machine->output_runs = NULL;
+	machine->output_runs_count = 0;
+	machine->output_bytes = NULL;
+
+	while (pc < machine->code_size)
+	{
+		uint32_t last_put[REGISTERS_COUNT];
+		uint8_t registers_set = 0;
+		uint32_t start = machine->code_size;
+		uint32_t end;
+
+		// Finds where the line ends, and the first put whose
+		// value is output: the puts before it set registers
+		// for what follows the run, often the target of a jump
+
+		for (end = pc; end < machine->code_size; end++)
+		{
+			uint32_t platter = machine->code[end].platter;
+			uint32_t number = operation_number(platter);
+
+			if (number == OPERATION_ORTHOGRAPHY)
+			{
+				last_put[put_register(platter)] = end;
+				registers_set |= 1 << put_register(platter);
+				continue;
+			}
+
+			uint32_t c = operation_c(platter);
+
+			if (number != OPERATION_OUTPUT || !(registers_set & (1 << c)) || put_value(machine->code[last_put[c]].platter) > 255)
+				break;
+
+			if (last_put[c] < start)
+				start = last_put[c];
+		}
+
+		if (start > end)
+			start = end;
+
+		OutputRun run;
+		memset(&run, 0, sizeof(OutputRun));
+
+		run.pc = start;
+		run.bytes = bytes_count;
+
+		uint32_t i;
+		for (i = start; i < end; i++)
+		{
+			uint32_t platter = machine->code[i].platter;
+
+			if (operation_number(platter) == OPERATION_ORTHOGRAPHY)
+			{
+				run.registers[put_register(platter)] = put_value(platter);
+				run.registers_set |= 1 << put_register(platter);
+				continue;
+			}
+
+			if (bytes_count == bytes_capacity)
+			{
+				bytes_capacity = bytes_capacity ? bytes_capacity * 2 : 256;
+				machine->output_bytes = (uint8_t*)realloc(machine->output_bytes, bytes_capacity);
+
+				if (machine->output_bytes == NULL)
+				{
+					fprintf(stderr, "FATAL: Error allocating %u bytes of output runs\n", bytes_capacity);
+					fatal(ERR_OUT_OF_MEMORY, machine);
+				}
+			}
+
+			machine->output_bytes[bytes_count++] = (uint8_t)run.registers[operation_c(platter)];
+		}
+
+		// No run can start within this one and output more
+
+		pc = end > pc ? end : pc + 1;
+		run.length = end - run.pc;
+		run.bytes_count = bytes_count - run.bytes;
+
+		if (run.bytes_count < OUTPUT_RUN_MIN_BYTES)
+		{
+			bytes_count = run.bytes;
+			continue;
+		}
+
+		if (machine->output_runs_count == runs_capacity)
+		{
+			runs_capacity = runs_capacity ? runs_capacity * 2 : 16;
+			machine->output_runs = (OutputRun*)realloc(machine->output_runs, runs_capacity * sizeof(OutputRun));
+
+			if (machine->output_runs == NULL)
+			{
+				fprintf(stderr, "FATAL: Error allocating %u output runs\n", runs_capacity);
+				fatal(ERR_OUT_OF_MEMORY, machine);
+			}
+		}
+
+		machine->output_runs[machine->output_runs_count++] = run;
+
+		// A program mapped from the code cache already has
+		// its runs fused: don't copy the page for nothing
+
+		if (machine->code[run.pc].handler != HANDLER_OUTPUT_RUN)
+			machine->code[run.pc].handler = HANDLER_OUTPUT_RUN;
+	}
+}
+
+/**
+ * Returns the last run starting at or before pc, runs
+ * being found in the order of the program.
+ */
+
+static OutputRun* find_output_run(uint32_t pc, Machine* machine)
+{
+	uint32_t low = 0;
+	uint32_t high = machine->output_runs_count;
+
+	while (low < high)
+	{
+		uint32_t middle = low + (high - low) / 2;
+
+		if (machine->output_runs[middle].pc <= pc)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low ? &machine->output_runs[low - 1] : NULL;
+}
+
+/**
+ * Makes the run holding an amended platter execute one
+ * operation at a time again.
+ */
+
+static void break_output_run(uint32_t location, Machine* machine)
+{
+	OutputRun* run = find_output_run(location, machine);
+
+	if (run == NULL || location - run->pc >= run->length)
+		return;
+
+	run->length = 0;
+	decode_instruction(&machine->code[run->pc], machine->code[run->pc].platter);
+
+	if (machine->breakpoints_count || machine->watchpoints_count)
+		patch_instruction(run->pc, machine);
+}
+
+/**
+ * Writes the whole machine to MEMORY_DUMP_FILE as a
+ * snapshot, with a single write per array, so that
+ * dumping a large machine takes about as long as the disk
+ * needs. umdump inspects it and um -S resumes from it.
+ */
+
+void dump_memory(Machine* machine)
+{
+	printf("***DUMPING MEMORY***\n");
+
+	FILE* out = fopen(MEMORY_DUMP_FILE, "wb");
+
+	if (!out)
+	{
+		fprintf(stderr, "ERROR: Error opening memory dump file %s.\n", MEMORY_DUMP_FILE);
+		return;
+	}
+
+	write_snapshot(out, machine);
+	fclose(out);
+}
+
+void dump_state(Machine* machine, uint32_t platter)
+{
+	if (operation_number(platter) != OPERATION_ORTHOGRAPHY)
+	{
+		printf("code: %x, op: %u, a: %u, b: %u, c: %u, ", 
+			platter,
+			operation_number(platter),
+			operation_a(platter),
+			operation_b(platter),
+			operation_c(platter)
+		);
+	}
+	else
+	{
+		printf("code: %x, op: %u, a: %u, data: %u, ", 
+			platter,
+			operation_number(platter),
+			put_register(platter),
+			put_value(platter)
+		);
+	}
+	
+	uint8_t i = 0;
+	for(i = 0; i < REGISTERS_COUNT; i++)
+	{
+		int32_t value = get_register(i, machine, 0);
+		printf("R%d: %u, ", i, value);
+	}
+
+	printf("pc: %u, cycle: %llu\n", get_register(PC_REGISTER, machine, 1), (unsigned long long)machine->cycle);
+}
+
+/**
+ * Counts an execution of the platter at pc in the '0'
+ * array. The counters grow with the program since
+ * load_program can replace it with a bigger one.
+ */
+
+void profile_instruction(uint32_t pc, Machine* machine)
+{
+	if (pc >= machine->profile_size)
+	{
+		uint32_t size = machine->profile_size ? machine->profile_size : 1024;
+
+		while (size <= pc)
+			size *= 2;
+
+		machine->profile = (uint64_t*)realloc(machine->profile, size * sizeof(uint64_t));
+
+		if (machine->profile == NULL)
+		{
+			fprintf(stderr, "FATAL: Error allocating %u profile counters\n", size);
+			exit(ERR_OUT_OF_MEMORY);
+		}
+
+		memset(machine->profile + machine->profile_size, 0, (size - machine->profile_size) * sizeof(uint64_t));
+		machine->profile_size = size;
+	}
+
+	machine->profile[pc]++;
+}
+
+/**
+ * Adds the operation about to be executed to the trace,
+ * along with the register it writes. Its value is filled
+ * in by trace_result once executed.
+ */
+
+void trace_operation(uint32_t pc, uint32_t platter, Machine* machine)
+{
+	uint8_t reg = TRACE_NO_REGISTER;
+
+	switch(operation_number(platter))
+	{
+		case 0:
+		case 1:
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+			reg = operation_a(platter);
+			break;
+
+		case 8:
+			reg = operation_b(platter);
+			break;
+
+		case 11:
+			reg = operation_c(platter);
+			break;
+
+		case 13:
+			reg = put_register(platter);
+			break;
+	}
+
+	trace_push(machine->trace, pc, platter, reg, 0);
+}
+
+/**
+ * Completes the last record with the value written by the
+ * operation. An input that would block, or an operation
+ * stopped by the debugger, is executed again later, so
+ * its record is dropped.
+ */
+
+void trace_result(Machine* machine)
+{
+	TraceRing* ring = machine->trace;
+	TraceRecord* record = trace_last(ring);
+
+	if (machine->status == MACHINE_WAITING_INPUT || machine->status == MACHINE_BREAKPOINT)
+		ring->head--;
+	else if (record->reg != TRACE_NO_REGISTER)
+		record->value = machine->registers[record->reg];
+}
+
+/**
+ * Writes the whole state of the machine: cycle, registers,
+ * the pool of abandoned identifiers and every array.
+ * Array contents are written as they are in memory, in
+ * a single write each. Returns -1 if writing failed.
+ */
+
+int write_snapshot(FILE* out, Machine* machine)
+{
+	uint32_t version = SNAPSHOT_VERSION;
+	uint64_t snapshot_cycle = machine->cycle;
+
+	fwrite(SNAPSHOT_MAGIC, 4, 1, out);
+	fwrite(&version, sizeof(uint32_t), 1, out);
+	fwrite(&snapshot_cycle, sizeof(uint64_t), 1, out);
+	fwrite(machine->registers, sizeof(machine->registers), 1, out);
+	fwrite(&machine->memory->size, sizeof(uint32_t), 1, out);
+	fwrite(&machine->memory->pool_pointer, sizeof(uint32_t), 1, out);
+	fwrite(machine->memory->pool, sizeof(uint32_t), machine->memory->pool_pointer, out);
+
+	uint32_t i;
+	for (i = 0; i < machine->memory->size; i++)
+	{
+		Array* array = &machine->memory->arrays[i];
+		uint32_t header[2] = { array->content != NULL, array->size };
+
+		fwrite(header, sizeof(header), 1, out);
+
+		if (array->content != NULL && array->size)
+			fwrite(array->content, sizeof(uint32_t), array->size, out);
+	}
+
+	if (ferror(out))
+	{
+		fprintf(stderr, "ERROR: Error writing snapshot at cycle %llu\n", (unsigned long long)machine->cycle);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Replaces the state of the machine with the snapshot
+ * read from in.
+ */
+
+void read_snapshot(FILE* in, Machine* machine)
+{
+	char magic[4];
+	uint32_t version = 0;
+	uint64_t snapshot_cycle = 0;
+	uint32_t size = 0;
+	uint32_t pool_pointer = 0;
+
+	if (fread(magic, 4, 1, in) != 1 || memcmp(magic, SNAPSHOT_MAGIC, 4) != 0
+		|| fread(&version, sizeof(uint32_t), 1, in) != 1 || version != SNAPSHOT_VERSION
+		|| fread(&snapshot_cycle, sizeof(uint64_t), 1, in) != 1
+		|| fread(machine->registers, sizeof(machine->registers), 1, in) != 1
+		|| fread(&size, sizeof(uint32_t), 1, in) != 1
+		|| fread(&pool_pointer, sizeof(uint32_t), 1, in) != 1
+		|| pool_pointer > size || size == 0)
+	{
+		fprintf(stderr, "FATAL: Invalid snapshot\n");
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	uint32_t i;
+	for (i = 0; i < machine->memory->size; i++)
+		free(machine->memory->arrays[i].content);
+
+	machine->memory->arrays = (Array*)realloc(machine->memory->arrays, size * sizeof(Array));
+	machine->memory->pool = (uint32_t*)realloc(machine->memory->pool, size * sizeof(uint32_t));
+
+	if (machine->memory->arrays == NULL || machine->memory->pool == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating %u arrays from snapshot\n", size);
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	machine->memory->size = size;
+	machine->memory->pool_pointer = pool_pointer;
+	machine->cycle = snapshot_cycle;
+
+	if (fread(machine->memory->pool, sizeof(uint32_t), pool_pointer, in) != pool_pointer)
+	{
+		fprintf(stderr, "FATAL: Truncated snapshot\n");
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	for (i = 0; i < size; i++)
+	{
+		Array* array = &machine->memory->arrays[i];
+		uint32_t header[2];
+
+		if (fread(header, sizeof(header), 1, in) != 1)
+		{
+			fprintf(stderr, "FATAL: Truncated snapshot at array %u\n", i);
+			exit(ERR_INVALID_PROGRAM_FILE);
+		}
+
+		array->size = header[1];
+		array->content = NULL;
+
+		if (!header[0])
+			continue;
+
+		array->content = (uint32_t*)malloc(array->size ? array->size * sizeof(uint32_t) : sizeof(uint32_t));
+
+		if (array->content == NULL)
+		{
+			fprintf(stderr, "FATAL: Error allocating array %u with size of %u platters from snapshot\n", i, array->size);
+			exit(ERR_OUT_OF_MEMORY);
+		}
+
+		if (fread(array->content, sizeof(uint32_t), array->size, in) != array->size)
+		{
+			fprintf(stderr, "FATAL: Truncated snapshot at array %u\n", i);
+			exit(ERR_INVALID_PROGRAM_FILE);
+		}
+	}
+
+	account_memory(machine);
+	decode_program(machine);
+}
+
+/**
+ * Moves past a snapshot without loading it.
+ */
+
+void skip_snapshot(FILE* in)
+{
+	uint32_t header[SNAPSHOT_HEADER_WORDS];
+
+	if (fread(header, sizeof(uint32_t), SNAPSHOT_HEADER_WORDS, in) != SNAPSHOT_HEADER_WORDS)
+	{
+		fprintf(stderr, "FATAL: Truncated snapshot\n");
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	uint32_t size = header[SNAPSHOT_HEADER_WORDS - 2];
+	uint32_t pool_pointer = header[SNAPSHOT_HEADER_WORDS - 1];
+	fseek(in, pool_pointer * sizeof(uint32_t), SEEK_CUR);
+
+	uint32_t i;
+	for (i = 0; i < size; i++)
+	{
+		if (fread(header, sizeof(uint32_t), 2, in) != 2)
+		{
+			fprintf(stderr, "FATAL: Truncated snapshot at array %u\n", i);
+			exit(ERR_INVALID_PROGRAM_FILE);
+		}
+
+		if (header[0])
+			fseek(in, header[1] * sizeof(uint32_t), SEEK_CUR);
+	}
+}
+
+/**
+ * Recomputes the live counters from the arrays, used when
+ * they are replaced all at once.
+ */
+
+void account_memory(Machine* machine)
+{
+	machine->memory->live_bytes = 0;
+	machine->memory->live_arrays = 0;
+
+	uint32_t i;
+	for (i = 0; i < machine->memory->size; i++)
+	{
+		if (machine->memory->arrays[i].content != NULL)
+		{
+			machine->memory->live_bytes += (uint64_t)machine->memory->arrays[i].size * sizeof(uint32_t);
+			machine->memory->live_arrays++;
+		}
+	}
+
+	if (machine->memory->live_bytes > machine->memory->peak_bytes)
+		machine->memory->peak_bytes = machine->memory->live_bytes;
+
+	if (machine->memory->live_arrays > machine->memory->peak_arrays)
+		machine->memory->peak_arrays = machine->memory->live_arrays;
+}
+
+/**
+ * A conservative mark and sweep, for programs that never
+ * abandon their arrays. Any register or platter holding the
+ * identifier of an active array keeps it alive, starting
+ * from the '0' array, and the others are abandoned as if
+ * the program had done it. Programs that compute their
+ * identifiers rather than storing them break this, which
+ * is why it's opt-in. The next collection happens once
+ * live memory has doubled.
+ */
+
+void collect_garbage(Machine* machine)
+{
+	Memory* memory = machine->memory;
+	uint8_t* marked = (uint8_t*)calloc(memory->size, sizeof(uint8_t));
+	uint32_t* pending = (uint32_t*)malloc(memory->size * sizeof(uint32_t));
+	uint32_t count = 0;
+
+	// Collecting is only an attempt to avoid running out of memory
+
+	if (marked == NULL || pending == NULL)
+	{
+		free(marked);
+		free(pending);
+		return;
+	}
+
+	#define MARK(id) \
+		do { uint32_t m = (id); if (m < memory->size && !marked[m] && memory->arrays[m].content != NULL) { marked[m] = 1; pending[count++] = m; } } while(0)
+
+	MARK(PROGRAM_ARRAY);
+
+	uint8_t r;
+	for (r = 0; r < REGISTERS_COUNT; r++)
+		MARK(machine->registers[r]);
+
+	while (count)
+	{
+		Array* array = &memory->arrays[pending[--count]];
+
+		uint32_t i;
+		for (i = 0; i < array->size; i++)
+			MARK(array->content[i]);
+	}
+
+	#undef MARK
+
+	uint32_t i;
+	for (i = 1; i < memory->size; i++)
+	{
+		Array* array = &memory->arrays[i];
+
+		if (array->content == NULL || marked[i])
+			continue;
+
+		memory->live_bytes -= (uint64_t)array->size * sizeof(uint32_t);
+		memory->live_arrays--;
+		memory->collected_arrays++;
+
+		free(array->content);
+		array->content = NULL;
+		array->size = 0;
+		memory->pool[memory->pool_pointer++] = i;
+	}
+
+	memory->collections++;
+
+	if (memory->live_bytes * 2 > memory->gc_threshold)
+		memory->gc_threshold = memory->live_bytes * 2;
+
+	free(marked);
+	free(pending);
+}
+
+void write_memory_stats(Machine* machine, FILE* out)
+{
+	fprintf(out, "[um] cycle %llu: %u live arrays (peak %u), %llu live bytes (peak %llu), %llu allocations\n",
+		(unsigned long long)machine->cycle,
+		machine->memory->live_arrays,
+		machine->memory->peak_arrays,
+		(unsigned long long)machine->memory->live_bytes,
+		(unsigned long long)machine->memory->peak_bytes,
+		(unsigned long long)machine->memory->allocations
+	);
+
+	if (machine->memory->gc_threshold)
+	{
+		fprintf(out, "[um] %llu collections freed %llu arrays\n",
+			(unsigned long long)machine->memory->collections,
+			(unsigned long long)machine->memory->collected_arrays
+		);
+	}
+}
+
+/**
+ * Lists the arrays, besides the '0' one, that were never
+ * abandoned, followed by the allocation size histogram.
+ */
+
+void write_leak_report(Machine* machine, FILE* out)
+{
+	uint32_t leaked = 0;
+	uint64_t leaked_bytes = 0;
+
+	write_memory_stats(machine, out);
+
+	uint32_t i;
+	for (i = 1; i < machine->memory->size; i++)
+	{
+		Array* array = &machine->memory->arrays[i];
+
+		if (array->content == NULL)
+			continue;
+
+		if (leaked < LEAK_REPORT_MAX_ARRAYS)
+			fprintf(out, "[um] leaked array %u: %u platters\n", i, array->size);
+
+		leaked++;
+		leaked_bytes += (uint64_t)array->size * sizeof(uint32_t);
+	}
+
+	if (leaked > LEAK_REPORT_MAX_ARRAYS)
+		fprintf(out, "[um] ... and %u more\n", leaked - LEAK_REPORT_MAX_ARRAYS);
+
+	fprintf(out, "[um] %u arrays (%llu bytes) were never abandoned\n", leaked, (unsigned long long)leaked_bytes);
+	fprintf(out, "[um] allocation sizes:\n");
+
+	uint8_t bucket;
+	for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+	{
+		if (machine->memory->histogram[bucket])
+		{
+			fprintf(out, "[um]   < 2^%-2u platters: %llu\n", bucket, (unsigned long long)machine->memory->histogram[bucket]);
+		}
+	}
+}
+
+/**
+ * The register A receives the value in register B,
+ * unless the register C contains 0.
+ */
+
+void conditional_move(uint32_t op, Machine* machine)
+{
+	TRACE("conditional_move r%d into r%d\n", operation_b(op), operation_a(op));
+
+	if (get_register(operation_c(op), machine, 0))
+		set_register(operation_a(op), get_register(operation_b(op), machine, 0), machine, 0);
+}
+
+/**
+ * The register A receives the value stored at offset
+ * in register C in the array identified by B.
+ */
+
+void array_index(uint32_t op, Machine* machine)
+{
+	TRACE("array_index accessing array[%d][%d] into r%d\n", operation_b(op), operation_c(op), operation_a(op));
+
+	uint32_t value = read_array(
+		get_register(operation_b(op), machine, 0),
+		get_register(operation_c(op), machine, 0),
+		machine
+	);
+
+	set_register(operation_a(op), value, machine, 0);
+}
+
+/**
+ * The array identified by A is amended at the offset
+ * in register B to store the value in register C.
+ */
+
+void array_amendment(uint32_t op, Machine* machine)
+{
+	TRACE("loading r%d into array[r%d][r%d]\n", operation_c(op), operation_a(op), operation_b(op));
+
+	write_array(
+		get_register(operation_a(op), machine, 0),
+		get_register(operation_b(op), machine, 0),
+		get_register(operation_c(op), machine, 0),
+		machine
+	);
+}
+
+/**
+ * The register A receives the value in register B plus
+ * the value in register C, modulo 2^32.
+ */
+void addition(uint32_t op, Machine* machine)
+{
+	uint32_t c = get_register(operation_c(op), machine, 0);
+	uint32_t b = get_register(operation_b(op), machine, 0);
+	TRACE("setting r%d = %u + %u\n", operation_a(op), b, c);
+	set_register(operation_a(op), b + c, machine, 0);
+}
+
+/**
+ * The register A receives the value in register B times
+ * the value in register C, modulo 2^32.
+ */
+void multiplication(uint32_t op, Machine* machine)
+{
+	TRACE("setting r%d = r%d * r%d\n", operation_a(op), operation_b(op), operation_c(op));
+	set_register(operation_a(op), get_register(operation_b(op), machine, 0) * get_register(operation_c(op), machine, 0), machine, 0);
+}
+
+/**
+ * The register A receives the value in register B
+ * divided by the value in register C, if any, where
+ * each quantity is treated treated as an unsigned 32
+ * bit number.
+ */
+
+void division(uint32_t op, Machine* machine)
+{
+	uint32_t divisor = get_register(operation_c(op), machine, 0);
+	uint32_t dividend = get_register(operation_b(op), machine, 0);
+
+	TRACE("setting r%d = %u / %u\n", operation_a(op), divisor, dividend);
+
+	if (divisor == 0)
+	{
+		fprintf(stderr, "FATAL: division by zero\n");
+		fatal(ERR_DIVISION_BY_ZERO, machine);
+	}
+
+	set_register(operation_a(op), dividend / divisor, machine, 0);
+}
+
+/**
+ * Each bit in the register A receives the 1 bit if
+ * either register B or register C has a 0 bit in that
+ * position.  Otherwise the bit in register A receives
+ * the 0 bit.
+ */
+
+void not_and(uint32_t op, Machine* machine)
+{
+	TRACE("setting r%d = ~(r%d & r%d)\n", operation_a(op), operation_b(op), operation_c(op));
+	set_register(operation_a(op), ~(get_register(operation_b(op), machine, 0) & get_register(operation_c(op), machine, 0)), machine, 0);
+}
+
+/**
+ * The universal machine stops computation.
+ */
+
+void halt(uint32_t op, Machine* machine)
+{
+	TRACE("halting excution.\n");
+
+
+#if defined(DEBUG)
+	dump_memory(machine);
+#endif
+
+	machine_stop(machine, MACHINE_HALTED);
+}
+
+/**
+ * A new array is created with a capacity of platters
+ * commensurate to the value in the register C. This
+ * new array is initialized entirely with platters
+ * holding the value 0. A bit pattern not consisting of
+ * exclusively the 0 bit, and that identifies no other
+ * active allocated array, is placed in the B register.
+ */
+
+void allocation(uint32_t op, Machine* machine)
+{
+	TRACE("allocating new array with the size in r%d and puts its index in r%d\n", operation_c(op), operation_b(op));
+	uint32_t index = allocate_array(get_register(operation_c(op), machine, 0), machine);
+	set_register(operation_b(op), index, machine, 0);
+}
+
+/**
+ * The array identified by the register C is abandoned.
+ * Future allocations may then reuse that identifier.
+ */
+
+void abandoment(uint32_t op, Machine* machine)
+{
+	TRACE("freeing array at index r%d\n", operation_c(op));
+
+	uint32_t index = (uint32_t)get_register(operation_c(op), machine, 0);
+
+	if (machine->memory->shared)
+		pthread_mutex_lock(&machine->memory->lock);
+
+	Array* a = get_array(index, machine);
+
+	#ifndef UNSAFE
+	if (a->content == NULL || index == PROGRAM_ARRAY)
+	{
+		fprintf(stderr, "FATAL: deallocating a non allocated array %d.\n", index);
+		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+	}
+	#endif
+
+	machine->memory->live_bytes -= (uint64_t)a->size * sizeof(uint32_t);
+	machine->memory->live_arrays--;
+
+	free(machine->memory->arrays[index].content);
+	machine->memory->arrays[index].content = NULL;
+	machine->memory->arrays[index].size = 0;
+	machine->memory->pool[machine->memory->pool_pointer++] = index;
+
+	if (machine->memory->shared)
+		pthread_mutex_unlock(&machine->memory->lock);
+}
+
+/**
+ * The value in the register C is displayed on the console
+ * immediately. Only values between and including 0 and 255
+ * are allowed.
+ */
+
+void output(uint32_t op, Machine* machine)
+{
+	uint32_t value = get_register(operation_c(op), machine, 0);
+
+	#ifndef UNSAFE
+	if (value > 255)
+	{
+		fprintf(stderr, "FATAL: output of %u, which is not a byte.\n", value);
+		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+	}
+	#endif
+
+	machine->write_byte(machine, (uint8_t)value);
+	machine->bytes_out++;
+}
+
+/**
+ * The universal machine waits for input on the console.
+ * When input arrives, the register C is loaded with the
+ * input, which must be between and including 0 and 255.
+ * If the end of input has been signaled, then the
+ * register C is endowed with a uniform value pattern
+ * where every place is pregnant with the 1 bit.
+ */
+
+void input(uint32_t op, Machine* machine)
+{
+	int c = machine->read_byte(machine);
+
+	// Execution resumes from this same operation once
+	// some input is available.
+
+	if (c == MACHINE_WOULD_BLOCK)
+	{
+		set_register(PC_REGISTER, get_register(PC_REGISTER, machine, 1) - 1, machine, 1);
+		machine->cycle--;
+		machine_stop(machine, MACHINE_WAITING_INPUT);
+		return;
+	}
+
+	machine->bytes_in += c != EOF;
+	set_register(operation_c(op), c == EOF ? 0xFFFFFFFF : (uint32_t)c, machine, 0);
+}
+
+/**
+ * The array identified by the B register is duplicated
+ * and the duplicate shall replace the '0' array,
+ * regardless of size. The execution finger is placed
+ * to indicate the platter of this array that is
+ * described by the offset given in C, where the value
+ * 0 denotes the first platter, 1 the second, et
+ * cetera.
+ *
+ * The '0' array shall be the most sublime choice for
+ * loading, and shall be handled with the utmost
+ * velocity.
+ */
+
+void load_program(uint32_t op, Machine* machine)
+{
+	uint32_t index = get_register(operation_b(op), machine, 0);
+	TRACE("loading program at array[%d] setting execution at offset %d\n", index, operation_c(op));
+
+	if (index)
+	{
+		TRACE("loading program from non 0 array, copying from %d into 0\n", index);
+
+		// The other machines execute the decoded '0' array too
+
+		#ifndef UNSAFE
+		if (machine->memory->shared && machine->memory->machines > 1)
+		{
+			fprintf(stderr, "FATAL: replacing the '0' array while %u machines are running.\n", machine->memory->machines);
+			fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+		}
+		#endif
+
+		Array* src = get_array(index, machine);
+
+		#ifndef UNSAFE
+		if (src->content == NULL)
+		{
+			fprintf(stderr, "FATAL: loading program from an unallocated array %d.\n", index);
+			fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+		}
+		#endif
+
+		allocate_memory(PROGRAM_ARRAY, src->size, machine);
+
+		Array* program = get_array(PROGRAM_ARRAY, machine);
+		memcpy(program->content, src->content, src->size * sizeof(uint32_t));
+		decode_program(machine);
+	}
+
+	set_register(PC_REGISTER, get_register(operation_c(op), machine, 0), machine, 1);
+}
+
+/**
+ * The value indicated is loaded into the register A
+ * forthwith.
+ */
+
+void ortography(uint32_t op, Machine* machine)
+{
+	TRACE("Setting register r%d = %d\n", put_register(op), put_value(op));
+	set_register(put_register(op), put_value(op), machine, 0);
+}
+
+/**
+ * Executes the platters whose operator number is not one
+ * of the fourteen operators, with the dialect the machine
+ * speaks if any, as an error otherwise.
+ */
+
+void invalid_operation(uint32_t op, Machine* machine)
+{
+	if (machine->extended_operation != NULL)
+	{
+		machine->extended_operation(op, machine);
+		return;
+	}
+
+	uint32_t pc = get_register(PC_REGISTER, machine, 1) - 1;
+
+	fprintf(stderr, "ERROR: Invalid opcode: %u (pc = 0x%x, offset = %zu)\n", operation_number(op), pc, pc * sizeof(uint32_t));
+	fatal(ERR_INVALID_OPCODE, machine);
+}
+
+/**
+ * Stops the machine on the operation under a breakpoint,
+ * which machine_step executes once the debugger resumes.
+ */
+
+void breakpoint(uint32_t op, Machine* machine)
+{
+	uint32_t pc = get_register(PC_REGISTER, machine, 1) - 1;
+
+	if (machine->profile != NULL)
+		machine->profile[pc]--;
+
+	set_register(PC_REGISTER, pc, machine, 1);
+	machine->cycle--;
+	machine_stop(machine, MACHINE_BREAKPOINT);
+}
+
+/**
+ * Amends an array like array_amendment, unless a
+ * watchpoint covers the platter: the machine then stops
+ * before writing it, like on a breakpoint.
+ */
+
+void watched_amendment(uint32_t op, Machine* machine)
+{
+	uint32_t array = get_register(operation_a(op), machine, 0);
+	uint32_t offset = get_register(operation_b(op), machine, 0);
+
+	uint32_t i;
+	for (i = 0; i < machine->watchpoints_count; i++)
+	{
+		Watchpoint* watchpoint = &machine->watchpoints[i];
+
+		if (watchpoint->array == array && (watchpoint->offset == WATCH_ANY_OFFSET || watchpoint->offset == offset))
+		{
+			breakpoint(op, machine);
+			return;
+		}
+	}
+
+	array_amendment(op, machine);
+}
+
+/**
+ * Executes a run of output found by fuse_output_runs: the
+ * registers and the execution finger get the values they
+ * have at its end, and its bytes are written at once.
+ * Profiles, traces, breakpoints and events due within the
+ * run have to see every operation, which are then executed
+ * one at a time.
+ */
+
+void output_run(uint32_t op, Machine* machine)
+{
+	uint32_t pc = get_register(PC_REGISTER, machine, 1) - 1;
+	OutputRun* run = find_output_run(pc, machine);
+
+	if (run == NULL || run->pc != pc || !run->length || machine->profile != NULL || machine->trace != NULL
+		|| machine->breakpoints_count || machine->cycle + run->length > machine->next_event)
+	{
+		opcodes_table[operation_number(op)](op, machine);
+		return;
+	}
+
+	uint32_t i;
+	for (i = 0; i < REGISTERS_COUNT; i++)
+	{
+		if (run->registers_set & (1 << i))
+			machine->registers[i] = run->registers[i];
+	}
+
+	set_register(PC_REGISTER, pc + run->length, machine, 1);
+
+	// Counted before writing, so that a hook stopping the
+	// machine stops it at the end of the run
+
+	machine->cycle += run->length - 1;
+	machine->bytes_out += run->bytes_count;
+
+	write_bytes(machine, machine->output_bytes + run->bytes, run->bytes_count);
+}
@@ -0,0 +1,237 @@
+#if !defined(__MACHINE_H)
+#define __MACHINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "operation.h"
+#include "trace.h"
+
+#define REGISTERS_COUNT 8
+#define EXTRA_REGISTERS 1
+#define PC_REGISTER REGISTERS_COUNT
+#define PROGRAM_ARRAY 0
+#define OPCODES_COUNT 14
+#define HANDLER_INVALID OPCODES_COUNT
+#define HANDLER_BREAKPOINT (OPCODES_COUNT + 1)
+#define HANDLER_WATCHED_AMENDMENT (OPCODES_COUNT + 2)
+#define HANDLER_OUTPUT_RUN (OPCODES_COUNT + 3)
+
+// Built with SPECIALIZED_HANDLERS, the seven operators
+// reading three registers have a handler for each of the
+// 512 combinations, and put one for each register
+
+#ifdef SPECIALIZED_HANDLERS
+#define SPECIALIZED_OPCODES 7
+#define SPECIALIZED_HANDLERS_BASE (OPCODES_COUNT + 4)
+#define SPECIALIZED_PUT_BASE (SPECIALIZED_HANDLERS_BASE + SPECIALIZED_OPCODES * 512)
+#define HANDLERS_COUNT (SPECIALIZED_PUT_BASE + REGISTERS_COUNT)
+#else
+#define HANDLERS_COUNT (OPCODES_COUNT + 4)
+#endif
+
+// Compressed images that are recognized but not supported
+#define ZSTD_MAGIC "\x28\xB5\x2F\xFD"
+
+#define SNAPSHOT_MAGIC "UMSN"
+#define SNAPSHOT_VERSION 1
+#define MEMORY_DUMP_FILE "memdump.ums"
+
+#define EVENTS_POLL_INTERVAL (1 << 24)
+#define HISTOGRAM_BUCKETS 33
+#define LEAK_REPORT_MAX_ARRAYS 100
+
+// Returned by a read_byte hook when no input is available yet
+#define MACHINE_WOULD_BLOCK -2
+
+// Shorter runs of output aren't worth looking up
+#define OUTPUT_RUN_MIN_BYTES 2
+
+// A watchpoint on every platter of an array
+#define WATCH_ANY_OFFSET 0xFFFFFFFF
+
+// Magic, version, cycle, registers, arrays count and pool pointer
+#define SNAPSHOT_HEADER_WORDS (4 + REGISTERS_COUNT + EXTRA_REGISTERS + 2)
+
+typedef enum MachineStatus {
+	MACHINE_RUNNING,
+	MACHINE_HALTED,
+	MACHINE_WAITING_INPUT,
+	MACHINE_PREEMPTED,
+	MACHINE_FAILED,
+	MACHINE_BREAKPOINT
+} MachineStatus;
+
+typedef struct Array {
+	uint32_t 	size;
+	uint32_t*	content;
+} Array;
+
+/**
+ * Besides the arrays, keeps track of how much memory
+ * they hold. The histogram counts allocations by size,
+ * bucket n holding sizes below 2^n platters. A non zero
+ * gc_threshold enables the collector. Once shared by the
+ * machines of a threaded program, allocating and
+ * abandoning take the lock, and the table of arrays never
+ * moves under a machine reading it: it grows into a new
+ * one, the former being retired until the memory is freed.
+ */
+
+typedef struct Memory {
+	uint32_t 	size;
+	Array*		arrays;
+	uint32_t*	pool;
+	uint32_t	pool_pointer;
+	uint64_t	live_bytes;
+	uint64_t	peak_bytes;
+	uint64_t	limit;
+	uint32_t	live_arrays;
+	uint32_t	peak_arrays;
+	uint64_t	allocations;
+	uint64_t	histogram[HISTOGRAM_BUCKETS];
+	uint64_t	gc_threshold;
+	uint64_t	collections;
+	uint64_t	collected_arrays;
+	int		shared;
+	pthread_mutex_t	lock;
+	uint32_t	capacity;
+	Array**		retired;
+	uint32_t	retired_count;
+	uint32_t	machines;
+} Memory;
+
+/**
+ * A platter of the '0' array decoded into the index of the
+ * handler executing it in opcodes_table, kept next to the
+ * platter the handler reads its operands from. Indices
+ * rather than pointers, so that the decoded program can be
+ * shared between processes.
+ */
+
+typedef struct Instruction {
+	uint32_t	platter;
+	uint32_t	handler;
+} Instruction;
+
+/**
+ * A straight line of put and output operations starting
+ * at pc, whose bytes are all known when the program is
+ * decoded. The registers set by the run keep the values
+ * they have at its end, registers_set telling which ones.
+ * A run whose length is 0 was broken by an amendment.
+ */
+
+typedef struct OutputRun {
+	uint32_t	pc;
+	uint32_t	length;
+	uint32_t	bytes;
+	uint32_t	bytes_count;
+	uint32_t	registers[REGISTERS_COUNT];
+	uint8_t		registers_set;
+} OutputRun;
+
+typedef struct Watchpoint {
+	uint32_t	array;
+	uint32_t	offset;
+} Watchpoint;
+
+typedef struct Machine Machine;
+
+/**
+ * Everything a machine needs to run on its own, so that
+ * a process can host many of them. The hooks default to
+ * the console and to polling every EVENTS_POLL_INTERVAL
+ * cycles, on_event being called whenever cycle reaches
+ * next_event. extended_operation, when a dialect sets it,
+ * executes the operators beyond the fourteen of the
+ * specification, with the state of the dialect in
+ * extension. An isolated machine fails on fatal errors
+ * instead of ending the process. The '0' array is executed
+ * from its decoded copy in code, mapped from the directory
+ * code_cache when one is given. Breakpoints and watchpoints
+ * are patched into that copy, so that they cost nothing
+ * to a machine without any. Runs of output from constant
+ * values are executed at once, from output_runs.
+ */
+
+struct Machine {
+	Memory*		memory;
+	uint32_t	registers[REGISTERS_COUNT + EXTRA_REGISTERS];
+	uint64_t	cycle;
+	uint64_t	next_event;
+	MachineStatus	status;
+	int		(*read_byte)(Machine* machine);
+	void		(*write_byte)(Machine* machine, uint8_t byte);
+	void		(*on_event)(Machine* machine);
+	void		(*extended_operation)(uint32_t op, Machine* machine);
+	void*		extension;
+	void*		context;
+	int		isolated;
+	jmp_buf*	trap;
+	uint64_t*	profile;
+	uint32_t	profile_size;
+	TraceRing*	trace;
+	Instruction*	code;
+	uint32_t	code_size;
+	size_t		code_mapped;
+	const char*	code_cache;
+	OutputRun*	output_runs;
+	uint32_t	output_runs_count;
+	uint8_t*	output_bytes;
+	uint64_t	bytes_in;
+	uint64_t	bytes_out;
+	uint32_t*	breakpoints;
+	uint32_t	breakpoints_count;
+	Watchpoint*	watchpoints;
+	uint32_t	watchpoints_count;
+};
+
+void machine_init(Machine* machine);
+void machine_free(Machine* machine);
+void machine_load_program(Machine* machine, const uint32_t* platters, uint32_t count);
+void machine_load_file(Machine* machine, const char* filename);
+MachineStatus machine_run(Machine* machine);
+MachineStatus machine_step(Machine* machine);
+void machine_stop(Machine* machine, MachineStatus status);
+pid_t machine_fork(Machine* machine);
+void machine_set_breakpoint(Machine* machine, uint32_t pc, int enabled);
+void machine_set_watchpoint(Machine* machine, uint32_t array, uint32_t offset, int enabled);
+
+void fatal(int code, Machine* machine);
+void initialize_memory(Machine* machine);
+void allocate_memory(uint32_t index, uint32_t size, Machine* machine);
+void dump_memory(Machine* machine);
+void dump_state(Machine* machine, uint32_t platter);
+
+uint32_t allocate_array(uint32_t size, Machine* machine);
+Array* get_array(uint32_t index, Machine* machine);
+uint32_t read_array(uint32_t index, uint32_t location, Machine* machine);
+void write_array(uint32_t index, uint32_t location, uint32_t value, Machine* machine);
+uint32_t compare_and_swap_array(uint32_t index, uint32_t location, uint32_t expected, uint32_t value, Machine* machine);
+void share_memory(Machine* machine);
+
+uint32_t get_register(uint8_t index, Machine* machine, int allow_extra);
+uint32_t set_register(uint8_t index, uint32_t value, Machine* machine, int allow_extra);
+uint32_t peek(Instruction** instruction, Machine* machine);
+void decode_program(Machine* machine);
+void fuse_output_runs(Machine* machine);
+void release_code(Machine* machine);
+
+void profile_instruction(uint32_t pc, Machine* machine);
+void trace_operation(uint32_t pc, uint32_t platter, Machine* machine);
+void trace_result(Machine* machine);
+
+int write_snapshot(FILE* out, Machine* machine);
+void read_snapshot(FILE* in, Machine* machine);
+void skip_snapshot(FILE* in);
+
+void account_memory(Machine* machine);
+void collect_garbage(Machine* machine);
+void write_memory_stats(Machine* machine, FILE* out);
+void write_leak_report(Machine* machine, FILE* out);
+
+#endif /* __MACHINE_H */
@@ -1,715 +1,719 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdint.h>
 #include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
 
 #include "error_codes.h"
+#include "machine.h"
+#include "perf.h"
+#include "debugger.h"
+#include "stats.h"
+#include "threads.h"
 
-#define REGISTERS_COUNT 8
-#define EXTRA_REGISTERS 1
-#define PC_REGISTER REGISTERS_COUNT
-#define PROGRAM_ARRAY 0
-#define OPCODES_COUNT 14
-
-#define GET_REGISTERS_COUNT(var, extra) \
-	uint8_t var;\
-	\
-	if (!extra)\
-		var = REGISTERS_COUNT;\
-	else\
-		var = REGISTERS_COUNT + EXTRA_REGISTERS\
-
-#ifdef DEBUG
-#define TRACE(...) printf( __VA_ARGS__)
-#else
-#define TRACE(...) 0
-#endif
-
-#include "operation.h"
-
-typedef struct Array {
-	uint32_t 	size;
-	int32_t*	content;
-} Array;
-
-typedef struct Memory {
-	uint32_t 	size;
-	Array*		arrays;
-	uint32_t*	pool;
-	uint32_t	pool_pointer;
-} Memory;
-
-typedef struct Machine {
-	Memory 		memory;
-	uint32_t	registers[REGISTERS_COUNT + EXTRA_REGISTERS];
-} Machine;
-
-void fatal(int code, Machine* machine);
-void initialize_memory(Machine* machine);
-void allocate_memory(uint32_t index, uint32_t size, Machine* machine);
-void dump_memory(Machine* machine);
-void dump_state(Machine* machine, Operation* operation, uint32_t inst);
-
-uint32_t allocate_array(uint32_t size, Machine* machine);
-Array* get_array(uint32_t index, Machine* machine);
-uint32_t read_array(uint32_t index, uint32_t location, Machine* machine);
-
-uint32_t get_register(uint8_t index, Machine* machine, int allow_extra);
-uint32_t set_register(uint8_t index, uint32_t value, Machine* machine, int allow_extra);
-int peek(Operation* operation, Machine* machine);
-
-void conditional_move(Operation* op, Machine* machine);
-void array_index(Operation* op, Machine* machine);
-void array_amendment(Operation* op, Machine* machine);
-void addition(Operation* op, Machine* machine);
-void multiplication(Operation* op, Machine* machine);
-void division(Operation* op, Machine* machine);
-void not_and(Operation* op, Machine* machine);
-void halt(Operation* op, Machine* machine);
-void allocation(Operation* op, Machine* machine);
-void abandoment(Operation* op, Machine* machine);
-void output(Operation* op, Machine* machine);
-void input(Operation* op, Machine* machine);
-void load_program(Operation* op, Machine* machine);
-void ortography(Operation* op, Machine* machine);
-
-void (*opcodes_table[OPCODES_COUNT]) (Operation*, Machine*) = {
-	conditional_move,
-	array_index,
-	array_amendment,
-	addition,
-	multiplication,
-	division,
-	not_and,
-	halt,
-	allocation,
-	abandoment,
-	output,
-	input,
-	load_program,
-	ortography
-};
-
-uint32_t cycle = 0;
+#define RECORDING_MAGIC "UMRR"
+#define RECORDING_VERSION 1
+#define RECORD_CHECKPOINT 'C'
+#define RECORD_INPUT 'I'
+#define RECORD_END_OF_INPUT 'E'
+#define DEFAULT_CHECKPOINT_INTERVAL 100000000
+
+void write_profile(void);
+void write_final_stats(void);
+void stop_tracing(void);
+
+void load_snapshot(const char* filename, Machine* machine);
+void start_recording(const char* filename, Machine* machine);
+void start_replay(const char* filename, uint64_t target, Machine* machine);
+void service_events(Machine* machine);
+void schedule_events(Machine* machine);
+int read_input(Machine* machine);
+uint64_t parse_size(const char* size);
+int run_clones(Machine* machine, const char* warmup_filename, char** inputs, int inputs_count, long jobs, int memory_report);
+void usage(const char* name);
+
+Machine machine;
+
+char* profile_filename = NULL;
+
+FILE* record_file = NULL;
+FILE* replay_file = NULL;
+uint64_t checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+uint64_t replay_target = 0;
+uint64_t next_checkpoint = 0;
+
+FILE* warmup_file = NULL;
+
+Stats* stats = NULL;
+
+volatile sig_atomic_t stats_requested = 0;
 
 void sig_term_handler(int sig) {
 	printf("SIGTERM/ABRT/INT received, halting Universal Machine!\n");
 	exit(0);
 }
 
+void sig_usr1_handler(int sig) {
+	stats_requested = 1;
+}
+
 int main(int argc, char *argv[])
 {
 	signal(SIGTERM, &sig_term_handler);
 	signal(SIGABRT, &sig_term_handler);
 	signal(SIGINT, &sig_term_handler);
-
-	if (argc < 2)
+	signal(SIGUSR1, &sig_usr1_handler);
+
+	char* record_filename = NULL;
+	char* replay_filename = NULL;
+	char* snapshot_filename = NULL;
+	char* trace_filename = NULL;
+	char* code_cache = NULL;
+	char* stats_filename = NULL;
+	uint64_t memory_limit = 0;
+	uint64_t gc_threshold = 0;
+	int memory_report = 0;
+	int fan_out = 0;
+	char* warmup_filename = NULL;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int perf_counters = 0;
+	int debug = 0;
+	char* debug_script = NULL;
+	int threads = 0;
+	int option;
+
+	static struct option long_options[] = {
+		{"perf-counters", no_argument, NULL, 'H'},
+		{"debug", optional_argument, NULL, 'D'},
+		{"threads", no_argument, NULL, 'T'},
+		{NULL, 0, NULL, 0}
+	};
+
+	while ((option = getopt_long(argc, argv, "p:R:P:S:i:c:t:m:MG:C:s:fw:j:", long_options, NULL)) != -1)
 	{
-		fprintf(stderr, "Usage: %s program_file\n", argv[0]);
-		exit(ERR_MISSING_ARGUMENTS);
-	}
+		switch(option)
+		{
+			case 'H':
+				perf_counters = 1;
+				break;
 
-	FILE* program_file = fopen(argv[1], "r");
+			case 'D':
+				debug = 1;
+				debug_script = optarg;
+				break;
 
-	if (program_file == NULL)
-	{
-		fprintf(stderr, "FATAL: Can't open program file: %s\n", argv[0]);
-		exit(ERR_INVALID_PROGRAM_FILE);
-	}
+			case 'T':
+				threads = 1;
+				break;
 
-	Machine machine;
-	memset((void*)&machine, 0, sizeof(Machine));
+			case 'm':
+				memory_limit = parse_size(optarg);
+				break;
 
-	initialize_memory(&machine);
+			case 'M':
+				memory_report = 1;
+				break;
 
-	fseek(program_file, 0, SEEK_END);
-	uint32_t fsize = ftell(program_file);
-	fseek(program_file, 0, SEEK_SET);
+			case 'G':
+				gc_threshold = parse_size(optarg);
 
-	allocate_memory(PROGRAM_ARRAY, fsize / sizeof(Operation), &machine);
-	Array* program_array = get_array(PROGRAM_ARRAY, &machine);
+				if (gc_threshold == 0)
+					usage(argv[0]);
+				break;
 
-	//fread(program_array->content, program_array->size * sizeof(Operation), 1, program_file);
-	uint32_t i = 0;
+			case 't':
+				trace_filename = optarg;
+				break;
 
-	for (i = 0; i < (fsize / 4); i++)
-	{
-		uint8_t c1, c2, c3, c4;
-		c1 = fgetc(program_file);
-		c2 = fgetc(program_file);
-		c3 = fgetc(program_file);
-		c4 = fgetc(program_file);
-		uint32_t instr = ((unsigned int)c1 << 24) + ((unsigned int)c2 << 16) + ((unsigned int)c3 << 8) + (unsigned int)c4;
-		program_array->content[i] = instr;
-	}
+			case 'C':
+				code_cache = optarg;
+				break;
 
-	fclose(program_file);
+			case 's':
+				stats_filename = optarg;
+				break;
 
-	Operation op;
-	for(;;)
-	{
-		peek(&op, &machine);
+			case 'p':
+				profile_filename = optarg;
+				break;
 
-		if (op.standard.number < 13)
-			TRACE("Opcode: %d - A: %d, B: %d, C: %d (value: %x)\n", op.standard.number, op.standard.a, op.standard.b, op.standard.c, operation_to_int(&op));
-		else
-			TRACE("Opcode: %d - A: %d, Value: %d (value: %x)\n", op.put.number, op.put.a, op.put.value, operation_to_int(&op));
+			case 'R':
+				record_filename = optarg;
+				break;
 
-		if (op.standard.number >= OPCODES_COUNT)
-		{
-			uint32_t pc = (uint32_t)get_register(PC_REGISTER, &machine, 1);
-			fprintf(stderr, "ERROR: Invalid opcode: %d (pc = 0x%x, offset = %zu)\n", op.standard.number, pc, pc * sizeof(uint32_t));
-		}
+			case 'P':
+				replay_filename = optarg;
+				break;
+
+			case 'S':
+				snapshot_filename = optarg;
+				break;
+
+			case 'i':
+				checkpoint_interval = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'c':
+				replay_target = strtoull(optarg, NULL, 10);
+				break;
+
+			case 'f':
+				fan_out = 1;
+				break;
+
+			case 'w':
+				warmup_filename = optarg;
+				break;
 
-		opcodes_table[op.standard.number](&op, &machine);
-		cycle++;
+			case 'j':
+				jobs = strtol(optarg, NULL, 10);
+
+				if (jobs < 1)
+					usage(argv[0]);
+				break;
+
+			default:
+				usage(argv[0]);
+		}
 	}
 
-	#if defined(DEBUG)
-		TRACE("Execution ended\n");
-		dump_memory(&machine);
-	#endif
+	if ((replay_filename == NULL && snapshot_filename == NULL && argc - optind < 1) || checkpoint_interval == 0)
+		usage(argv[0]);
 
-	return 0;
-}
+	if (replay_filename != NULL && snapshot_filename != NULL)
+		usage(argv[0]);
 
-void fatal(int code, Machine* machine)
-{
-	#ifndef DISABLE_MEMORY_DUMP
-		dump_memory(machine);
-	#endif
+	// Clones are forked processes: a trace writer thread, a
+	// recording or a profile would be shared by all of them
 
-	exit(code);
-}
+	if (fan_out && (argc - optind < 2 || replay_filename || record_filename || trace_filename || profile_filename || perf_counters || debug || stats_filename))
+		usage(argv[0]);
 
-void initialize_memory(Machine* machine)
-{
-	machine->memory.arrays = (Array*)malloc(sizeof(Array));
+	// Threads make the input and the order of execution
+	// nondeterministic, and hold identifiers the collector
+	// can't see in registers of their own
+
+	if (threads && (fan_out || replay_filename || record_filename || trace_filename || profile_filename || debug || gc_threshold))
+		usage(argv[0]);
 
-	#ifndef UNSAFE
-	if (machine->memory.arrays == NULL)
+	machine_init(&machine);
+	machine.memory->limit = memory_limit;
+	machine.memory->gc_threshold = gc_threshold;
+	machine.code_cache = code_cache;
+	machine.read_byte = read_input;
+	machine.on_event = service_events;
+
+	// A recording starts with a checkpoint of the loaded
+	// program, so there's nothing else to load.
+
+	if (replay_filename != NULL)
 	{
-		fprintf(stderr, "FATAL: Error allocating memory pointers\n");
-		fatal(ERR_OUT_OF_MEMORY, machine);
+		start_replay(replay_filename, replay_target, &machine);
 	}
-	#endif
-
-	machine->memory.pool = (uint32_t*)malloc(sizeof(uint32_t));
+	else if (snapshot_filename != NULL)
+	{
+		load_snapshot(snapshot_filename, &machine);
 
-	#ifndef UNSAFE
-	if (machine->memory.pool == NULL)
+		if (record_filename != NULL)
+			start_recording(record_filename, &machine);
+	}
+	else
 	{
-		fprintf(stderr, "FATAL: Error allocating memory pool\n");
-		fatal(ERR_OUT_OF_MEMORY, machine);
+		machine_load_file(&machine, argv[optind]);
+
+		if (record_filename != NULL)
+			start_recording(record_filename, &machine);
 	}
-	#endif
 
-	memset(machine->memory.pool, 0, sizeof(uint32_t));
-	memset(machine->memory.arrays, 0, sizeof(Array));
-	machine->memory.pool_pointer = 0;
-}
+	if (threads)
+		threads_enable(&machine);
 
-void allocate_memory(uint32_t index, uint32_t size, Machine* machine)
-{
-	if (machine->memory.size < (index + 1))
+	if (profile_filename != NULL)
 	{
-		TRACE("memory needs to be resized from %u to %u\n", machine->memory.size, (index + 1));
-		machine->memory.arrays = (Array*)realloc(machine->memory.arrays, (index + 1) * sizeof(Array));
-		machine->memory.pool = (Array*)realloc(machine->memory.pool, (index + 1) * sizeof(uint32_t));
-
-		#ifndef UNSAFE
-		if (machine->memory.arrays == NULL)
-		{
-			fprintf(stderr, "FATAL: Error resizing memory pointers while "
-				"allocating array %d with size of %d bytes\n", index, size);
+		profile_instruction(0, &machine);
+		machine.profile[0] = 0;
+		atexit(write_profile);
+	}
 
-			fatal(ERR_OUT_OF_MEMORY, machine);
-		}
-		#endif
+	if (trace_filename != NULL)
+	{
+		machine.trace = trace_open(trace_filename, machine.cycle);
 
-		uint32_t i;
-		for(i = machine->memory.size; i < index + 1; i++)
+		if (machine.trace == NULL)
 		{
-			TRACE("initializing unallocated array %u\n", i);
-			machine->memory.arrays[i].content = NULL;
-			machine->memory.arrays[i].size = 0;
+			fprintf(stderr, "FATAL: Can't open trace file: %s\n", trace_filename);
+			exit(ERR_INVALID_PROGRAM_FILE);
 		}
 
-		machine->memory.size = index + 1;
+		atexit(stop_tracing);
 	}
 
-	if (machine->memory.arrays[index].content == NULL)
+	if (stats_filename != NULL)
 	{
-		machine->memory.arrays[index].content = (uint32_t*)malloc(size * sizeof(uint32_t));
+		stats = stats_open(stats_filename);
 
-		#ifndef UNSAFE
-		if (!machine->memory.arrays[index].content)
+		if (stats == NULL)
 		{
-			fprintf(stderr, "FATAL: Error allocating array %d with size of %d bytes\n", index, size);
-			fatal(ERR_OUT_OF_MEMORY, machine);
+			fprintf(stderr, "FATAL: Can't create statistics file: %s\n", stats_filename);
+			exit(ERR_INVALID_PROGRAM_FILE);
 		}
-		#endif
+
+		stats_update(stats, &machine);
+		atexit(write_final_stats);
 	}
-	else
+
+	schedule_events(&machine);
+
+	if (fan_out)
+		return run_clones(&machine, warmup_filename, argv + optind + 1, argc - optind - 1, jobs, memory_report);
+
+	if (debug)
 	{
-		machine->memory.arrays[index].content = (uint32_t*)realloc(machine->memory.arrays[index].content, size * sizeof(uint32_t));
+		FILE* commands = fopen(debug_script != NULL ? debug_script : "/dev/tty", "r");
 
-		#ifndef UNSAFE
-		if (!machine->memory.arrays[index].content)
+		if (commands == NULL)
 		{
-			fprintf(stderr, "FATAL: Error resizing array %d with size of %d bytes\n", index, size);
-			fatal(ERR_OUT_OF_MEMORY, machine);
+			fprintf(stderr, "FATAL: Can't read debugger commands from %s\n", debug_script != NULL ? debug_script : "/dev/tty");
+			exit(ERR_MISSING_ARGUMENTS);
 		}
-		#endif
-	}
 
-	memset((void*)machine->memory.arrays[index].content, 0, (size_t)(size * sizeof(uint32_t)));
-	machine->memory.arrays[index].size = size;
-
-	TRACE("allocate_memory(index = %u, size = %u)\n", index, size);
-}
+		MachineStatus status = debug_machine(&machine, commands);
+		fclose(commands);
 
-Array* get_array(uint32_t index, Machine* machine)
-{
-	#ifndef UNSAFE
-	if ((machine->memory.size - 1) < index)
-	{
-		fprintf(stderr, "FATAL: Error accessing unallocated array at index %d. Last index is %d.\n", index, machine->memory.size - 1);
-		fatal(ERR_OUT_OF_MEMORY, machine);
+		return status == MACHINE_FAILED ? ERR_PROGRAM_EXECUTION_ENDED_UNEXPECTEDLY : 0;
 	}
-	#endif
 
-	return &machine->memory.arrays[index];
-}
+	PerfCounters counters;
 
-uint32_t read_array(uint32_t index, uint32_t location, Machine* machine)
-{
-	Array* array = get_array(index, machine);
+	if (perf_counters && perf_open(&counters) == 0)
+		fprintf(stderr, "WARNING: no hardware counter is available, check perf_event_paranoid\n");
 
-	#ifndef UNSAFE
-	if (location >= array->size)
+	if (perf_counters)
+		perf_start(&counters);
+
+	machine_run(&machine);
+
+	if (perf_counters)
 	{
-		fprintf(stderr, "FATAL: reading array %u at %u, which is beyond its last index %u.\n", index, location, array->size - 1);
-		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+		perf_stop(&counters);
+		perf_write(&counters, machine.cycle, stderr);
+		perf_close(&counters);
 	}
-	#endif
 
-	return array->content[location];
+	if (memory_report)
+		write_leak_report(&machine, stderr);
+
+	return 0;
 }
 
-uint32_t allocate_array(uint32_t size, Machine* machine)
+/**
+ * Writes a "pc count" line for every platter that
+ * was executed at least once.
+ */
+
+void write_profile(void)
 {
-	uint32_t index = 0;
+	FILE* out = fopen(profile_filename, "w");
 
-	if (machine->memory.pool_pointer)
-	{
-		index = machine->memory.pool[machine->memory.pool_pointer - 1];
-		TRACE("resurrecting array %u from the pool", index);
-		machine->memory.pool_pointer--;
-	}
-	else
+	if (!out)
 	{
-		uint32_t i;
-		for(i = 1; i < machine->memory.size; i++)
-		{
-			if (machine->memory.arrays[i].content == NULL)
-			{
-				index = i;
-				break;
-			}
-		}
+		fprintf(stderr, "ERROR: Error opening profile file %s.\n", profile_filename);
+		return;
 	}
 
-	if (!index)
-		index = machine->memory.size;
+	fprintf(out, "# um profile: pc count\n");
 
-	TRACE("allocate_array(%u) = %u\n", size, index);
-
-	allocate_memory(index, size, machine);
+	uint32_t i;
+	for (i = 0; i < machine.profile_size; i++)
+	{
+		if (machine.profile[i])
+			fprintf(out, "%u %llu\n", i, (unsigned long long)machine.profile[i]);
+	}
 
-	return index;
+	fclose(out);
 }
 
-uint32_t get_register(uint8_t index, Machine* machine, int allow_extra)
+void write_final_stats(void)
 {
-	GET_REGISTERS_COUNT(max_register, allow_extra);
-
-	#ifndef UNSAFE
-	if (index >= max_register)
-	{
-		fprintf(stderr, "FATAL: trying to get invalid register %d, (extra = %d, last = %d)\n", index, allow_extra, max_register);
-		fatal(ERR_INVALID_REGISTER_ACCESS, machine);
-	}
-	#endif
+	stats_update(stats, &machine);
+}
 
-	return machine->registers[index];
+void stop_tracing(void)
+{
+	trace_close(machine.trace);
+	machine.trace = NULL;
 }
 
-uint32_t set_register(uint8_t index, uint32_t value, Machine* machine, int allow_extra)
+/**
+ * Resumes a machine from a snapshot, such as the dump
+ * written on a fatal error.
+ */
+
+void load_snapshot(const char* filename, Machine* machine)
 {
-	GET_REGISTERS_COUNT(max_register, allow_extra);
+	FILE* in = fopen(filename, "rb");
 
-	#ifndef UNSAFE
-	if (index >= max_register)
+	if (in == NULL)
 	{
-		fprintf(stderr, "FATAL: trying to set invalid register %d", index);
-		fatal(ERR_INVALID_REGISTER_ACCESS, machine);
+		fprintf(stderr, "FATAL: Can't open snapshot file: %s\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
 	}
-	#endif
-
-	uint32_t old_value = machine->registers[index];
-	machine->registers[index] = value;
 
-	return old_value;
+	read_snapshot(in, machine);
+	fclose(in);
 }
 
-int peek(Operation* operation, Machine* machine)
+/**
+ * Starts logging the only nondeterministic inputs of the
+ * machine, the bytes read by input(), along with periodic
+ * checkpoints. The first checkpoint holds the program.
+ */
+
+void start_recording(const char* filename, Machine* machine)
 {
-	uint32_t pc = get_register(PC_REGISTER, machine, 1);
-	Array* program = get_array(PROGRAM_ARRAY, machine);
+	record_file = fopen(filename, "wb");
 
-	#ifndef UNSAFE
-	if (pc >= program->size)
+	if (record_file == NULL)
 	{
-		fprintf(stderr, "FATAL: program execution reached the end and no halt operation was encountered\n");
-		fprintf(stderr, "pc = %u, last platter = %u\n", pc, program->size);
-		fatal(ERR_PROGRAM_EXECUTION_ENDED_UNEXPECTEDLY, machine);
+		fprintf(stderr, "FATAL: Can't open recording file: %s\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
 	}
-	#endif
 
-	int_to_operation(program->content[pc], operation);
+	uint32_t version = RECORDING_VERSION;
+
+	fwrite(RECORDING_MAGIC, 4, 1, record_file);
+	fwrite(&version, sizeof(uint32_t), 1, record_file);
+	fputc(RECORD_CHECKPOINT, record_file);
 
-	return set_register(PC_REGISTER, pc + 1, machine, 1);
+	if (write_snapshot(record_file, machine) != 0)
+		exit(ERR_INVALID_PROGRAM_FILE);
+
+	next_checkpoint = machine->cycle + checkpoint_interval;
 }
 
-void dump_memory(Machine* machine)
-{
-	printf("***DUMPING MEMORY***\n");
+/**
+ * Restores the last checkpoint of the recording taken
+ * before target, and leaves the file positioned so that
+ * input() reads the bytes consumed after it. When a target
+ * is given, the machine stops once it gets there.
+ */
 
-	FILE* out = fopen("memdump.txt", "w+");
+void start_replay(const char* filename, uint64_t target, Machine* machine)
+{
+	replay_file = fopen(filename, "rb");
 
-	if (!out)
+	if (replay_file == NULL)
 	{
-		fprintf(stderr, "ERROR: Error opening memdump file.");
-		return;
+		fprintf(stderr, "FATAL: Can't open recording file: %s\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
 	}
 
-	uint8_t i = 0;
-	for(i = 0; i < REGISTERS_COUNT; i++)
+	char magic[4];
+	uint32_t version = 0;
+
+	if (fread(magic, 4, 1, replay_file) != 1 || memcmp(magic, RECORDING_MAGIC, 4) != 0
+		|| fread(&version, sizeof(uint32_t), 1, replay_file) != 1 || version != RECORDING_VERSION)
 	{
-		int32_t value = get_register(i, machine, 0);
-		fprintf(out, "R%d: %d (unsigned = %u) (hex = 0x%x)\n", i, value, value, value);
+		fprintf(stderr, "FATAL: %s is not a valid recording\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
 	}
 
-	fprintf(out, "\n\nAllocated arrays: %d\n\n", machine->memory.size);
-
-	uint32_t k = 0;
-	uint32_t j = 0;
+	long checkpoint = -1;
+	uint64_t checkpoint_cycle = 0;
+	int type;
 
-	for (j = 0; j < machine->memory.size; j++)
+	while ((type = fgetc(replay_file)) != EOF)
 	{
-		if (machine->memory.arrays[j].content != NULL)
+		if (type == RECORD_CHECKPOINT)
 		{
-			fprintf(out, "-- Array %lu is %lu platters (%lu bytes) --\n\n", j, machine->memory.arrays[j].size, machine->memory.arrays[j].size * sizeof(uint32_t));
+			long position = ftell(replay_file);
+			uint64_t snapshot_cycle;
+
+			fseek(replay_file, 8, SEEK_CUR);
+
+			if (fread(&snapshot_cycle, sizeof(uint64_t), 1, replay_file) != 1)
+				break;
 
-			for (k = 0; k < machine->memory.arrays[j].size; k++)
+			fseek(replay_file, position, SEEK_SET);
+
+			// A checkpoint at target itself would leave no cycle
+			// at which to stop, so the one before is taken
+
+			if (checkpoint == -1 || (target && snapshot_cycle < target))
 			{
-				fprintf(out, "%x ", machine->memory.arrays[j].content[k]);
+				checkpoint = position;
+				checkpoint_cycle = snapshot_cycle;
 			}
+
+			if (!target || snapshot_cycle >= target)
+				break;
+
+			skip_snapshot(replay_file);
 		}
-		else
+		else if (type == RECORD_INPUT)
 		{
-			fprintf(out, "-- Array %d is not allocated", j);
+			fgetc(replay_file);
 		}
+	}
 
-		fprintf(out, "\n\n-- END --\n\n");
+	if (checkpoint == -1)
+	{
+		fprintf(stderr, "FATAL: %s has no checkpoint\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
 	}
 
-	fclose(out);
+	fprintf(stderr, "Replaying from the checkpoint at cycle %llu\n", (unsigned long long)checkpoint_cycle);
+
+	fseek(replay_file, checkpoint, SEEK_SET);
+	read_snapshot(replay_file, machine);
 }
 
-void dump_state(Machine* machine, Operation* operation, uint32_t inst)
+/**
+ * Called when cycle reaches next_event, so that features
+ * which need to act periodically cost a single comparison
+ * per cycle. Takes a checkpoint while recording, stops
+ * a replay at its target cycle and serves the requests
+ * made by signals.
+ */
+
+void service_events(Machine* machine)
 {
-	if (operation->standard.number != 13) 
+	if (replay_file != NULL && replay_target && machine->cycle == replay_target)
 	{
-		printf("code: %x, op: %u, a: %u, b: %u, c: %u, ", 
-			inst,
-			operation->standard.number,
-			operation->standard.a,
-			operation->standard.b,
-			operation->standard.c
-		);
+		fprintf(stderr, "Replay reached cycle %llu\n", (unsigned long long)machine->cycle);
+		dump_memory(machine);
+		machine_stop(machine, MACHINE_HALTED);
+		return;
 	}
-	else
+
+	if (record_file != NULL && machine->cycle == next_checkpoint)
 	{
-		printf("code: %x, op: %u, a: %u, data: %u, ", 
-			inst,
-			operation->put.number,
-			operation->put.a,
-			operation->put.value
-		);
+		fputc(RECORD_CHECKPOINT, record_file);
+
+		if (write_snapshot(record_file, machine) != 0)
+			exit(ERR_INVALID_PROGRAM_FILE);
+
+		next_checkpoint = machine->cycle + checkpoint_interval;
 	}
-	
-	uint8_t i = 0;
-	for(i = 0; i < REGISTERS_COUNT; i++)
+
+	if (stats_requested)
 	{
-		int32_t value = get_register(i, machine, 0);
-		printf("R%d: %u, ", i, value);
+		stats_requested = 0;
+		write_memory_stats(machine, stderr);
 	}
 
-	printf("pc: %u, cycle: %u\n", get_register(PC_REGISTER, machine, 1), cycle);
-}
+	if (stats != NULL)
+		stats_update(stats, machine);
 
-/**
- * The register A receives the value in register B,
- * unless the register C contains 0.
- */
-
-void conditional_move(Operation* op, Machine* machine)
-{
-	TRACE("conditional_move r%d into r%d\n", op->standard.b, op->standard.a);
-
-	if (get_register(op->standard.c, machine, 0))
-		set_register(op->standard.a, get_register(op->standard.b, machine, 0), machine, 0);
+	schedule_events(machine);
 }
 
 /**
- * The register A receives the value stored at offset
- * in register C in the array identified by B.
+ * Sets next_event to the closest cycle at which something
+ * has to be done. Signals are checked at least every
+ * EVENTS_POLL_INTERVAL cycles.
  */
 
-void array_index(Operation* op, Machine* machine)
+void schedule_events(Machine* machine)
 {
-	TRACE("array_index accessing array[%d][%d] into r%d\n", op->standard.b, op->standard.c, op->standard.a);
+	uint32_t delay = EVENTS_POLL_INTERVAL;
 
-	uint32_t value = read_array(
-		get_register(op->standard.b, machine, 0),
-		get_register(op->standard.c, machine, 0),
-		machine
-	);
+	if (record_file != NULL && next_checkpoint - machine->cycle < delay)
+		delay = next_checkpoint - machine->cycle;
 
-	set_register(op->standard.a, value, machine, 0);
+	if (replay_file != NULL && replay_target > machine->cycle && replay_target - machine->cycle < delay)
+		delay = replay_target - machine->cycle;
+
+	machine->next_event = machine->cycle + delay;
 }
 
 /**
- * The array identified by A is amended at the offset
- * in register B to store the value in register C.
+ * Reads the next input byte, from the console, from the
+ * warmup input or, when replaying, from the recording.
+ * Checkpoints met along the way are skipped.
  */
 
-void array_amendment(Operation* op, Machine* machine)
+int read_input(Machine* machine)
 {
-	Array* array = get_array(get_register(op->standard.a, machine, 0), machine);
-
-	uint32_t location = get_register(op->standard.b, machine, 0);
+	int c;
 
-	#ifndef UNSAFE
-	if (location >= array->size)
+	if (replay_file != NULL)
 	{
-		fprintf(stderr, "FATAL: trying to set value of array in r%d at %d, beyond its last index %d.\n",
-			op->standard.b, location, array->size - 1
-		);
+		int type;
 
-		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
-	}
-	#endif
+		while ((type = fgetc(replay_file)) == RECORD_CHECKPOINT)
+			skip_snapshot(replay_file);
 
-	uint32_t value = get_register(op->standard.c, machine, 0);
-	TRACE("loading %u into array[%d][%d]\n", value, op->standard.a, location);
-	array->content[location] = value;
-}
-
-/**
- * The register A receives the value in register B plus
- * the value in register C, modulo 2^32.
- */
-void addition(Operation* op, Machine* machine)
-{
-	uint32_t c = get_register(op->standard.c, machine, 0);
-	uint32_t b = get_register(op->standard.b, machine, 0);
-	TRACE("setting r%d = %u + %u\n", op->standard.a, b, c);
-	set_register(op->standard.a, b + c, machine, 0);
-}
-
-/**
- * The register A receives the value in register B times
- * the value in register C, modulo 2^32.
- */
-void multiplication(Operation* op, Machine* machine)
-{
-	TRACE("setting r%d = r%d * r%d\n", op->standard.a, op->standard.b, op->standard.c);
-	set_register(op->standard.a, get_register(op->standard.b, machine, 0) * get_register(op->standard.c, machine, 0), machine, 0);
-}
+		if (type == RECORD_INPUT)
+			return fgetc(replay_file);
 
-/**
- * The register A receives the value in register B
- * divided by the value in register C, if any, where
- * each quantity is treated treated as an unsigned 32
- * bit number.
- */
+		if (type != RECORD_END_OF_INPUT)
+			fprintf(stderr, "WARNING: the recording ended, signaling the end of input\n");
 
-void division(Operation* op, Machine* machine)
-{
-	uint32_t divisor = get_register(op->standard.c, machine, 0);
-	uint32_t dividend = get_register(op->standard.b, machine, 0);
+		return EOF;
+	}
 
-	TRACE("setting r%d = %u / %u\n", op->standard.a, divisor, dividend);
+	// The machine is cloned once the warmup input is over
 
-	if (divisor == 0)
+	if (warmup_file != NULL)
 	{
-		fprintf(stderr, "FATAL: division by zero\n");
-		fatal(ERR_DIVISION_BY_ZERO, machine);
+		c = getc(warmup_file);
+		return c == EOF ? MACHINE_WOULD_BLOCK : c;
 	}
 
-	set_register(op->standard.a, dividend / divisor, machine, 0);
-}
+	c = getc(stdin);
 
-/**
- * Each bit in the register A receives the 1 bit if
- * either register B or register C has a 0 bit in that
- * position.  Otherwise the bit in register A receives
- * the 0 bit.
- */
+	if (record_file != NULL)
+	{
+		if (c == EOF)
+		{
+			fputc(RECORD_END_OF_INPUT, record_file);
+		}
+		else
+		{
+			fputc(RECORD_INPUT, record_file);
+			fputc(c, record_file);
+		}
+	}
 
-void not_and(Operation* op, Machine* machine)
-{
-	TRACE("setting r%d = ~(r%d & r%d)\n", op->standard.a, op->standard.b, op->standard.c);
-	set_register(op->standard.a, ~(get_register(op->standard.b, machine, 0) & get_register(op->standard.c, machine, 0)), machine, 0);
+	return c;
 }
 
 /**
- * The universal machine stops computation.
+ * Parses a size in bytes, optionally followed by K, M or G.
  */
 
-void halt(Operation* op, Machine* machine)
+uint64_t parse_size(const char* size)
 {
-	TRACE("halting excution.\n");
+	char* unit = NULL;
+	int shift = 0;
 
-#if defined(DEBUG)
-	dump_memory(machine);
-#endif
+	errno = 0;
+	uint64_t value = strtoull(size, &unit, 10);
+	int valid = unit != size && *size != '-' && errno != ERANGE;
 
-	exit(0);
-}
+	switch(*unit)
+	{
+		case 'G': case 'g': shift = 30; unit++; break;
+		case 'M': case 'm': shift = 20; unit++; break;
+		case 'K': case 'k': shift = 10; unit++; break;
+	}
 
-/**
- * A new array is created with a capacity of platters
- * commensurate to the value in the register C. This
- * new array is initialized entirely with platters
- * holding the value 0. A bit pattern not consisting of
- * exclusively the 0 bit, and that identifies no other
- * active allocated array, is placed in the B register.
- */
+	if (!valid || *unit != '\0' || value > (UINT64_MAX >> shift))
+	{
+		fprintf(stderr, "FATAL: Invalid size '%s', expected a number optionally followed by K, M or G\n", size);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
 
-void allocation(Operation* op, Machine* machine)
-{
-	TRACE("allocating new array with the size in r%d and puts its index in r%d\n", op->standard.c, op->standard.b);
-	uint32_t index = allocate_array(get_register(op->standard.c, machine, 0), machine);
-	set_register(op->standard.b, index, machine, 0);
+	return value << shift;
 }
 
 /**
- * The array identified by the register C is abandoned.
- * Future allocations may then reuse that identifier.
+ * Runs the machine until it waits for input, feeding it
+ * the warmup input if any, then forks a clone for every
+ * input. Clones share the memory of the warmed up machine
+ * copy-on-write, so they only pay for the pages they
+ * change. Each clone reads its input file and writes its
+ * output next to it, with a .out extension. At most jobs
+ * clones run at once.
  */
 
-void abandoment(Operation* op, Machine* machine)
+int run_clones(Machine* machine, const char* warmup_filename, char** inputs, int inputs_count, long jobs, int memory_report)
 {
-	TRACE("freeing array at index r%d\n", op->standard.c);
-
-	uint32_t index = (uint32_t)get_register(op->standard.c, machine, 0);
-	Array* a = get_array(index, machine);
+	if (warmup_filename != NULL)
+	{
+		warmup_file = fopen(warmup_filename, "rb");
 
-	#ifndef UNSAFE
-	if (a->content == NULL)
+		if (warmup_file == NULL)
+		{
+			fprintf(stderr, "FATAL: Can't open warmup input: %s\n", warmup_filename);
+			exit(ERR_INVALID_PROGRAM_FILE);
+		}
+	}
+	else
 	{
-		fprintf(stderr, "FATAL: deallocating a non allocated array %d.\n", index);
-		fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+		warmup_file = fopen("/dev/null", "rb");
 	}
-	#endif
 
-	free(machine->memory.arrays[index].content);
-	machine->memory.arrays[index].content = NULL;
-	machine->memory.arrays[index].size = 0;
-	machine->memory.pool[machine->memory.pool_pointer++] = index;
-}
+	if (machine_run(machine) != MACHINE_WAITING_INPUT)
+	{
+		fprintf(stderr, "FATAL: The program ended before reading its input\n");
+		exit(ERR_PROGRAM_EXECUTION_ENDED_UNEXPECTEDLY);
+	}
 
-/**
- * The value in the register C is displayed on the console
- * immediately. Only values between and including 0 and 255
- * are allowed.
- */
+	fclose(warmup_file);
+	warmup_file = NULL;
 
-void output(Operation* op, Machine* machine)
-{
-	char c = (char)get_register(op->standard.c, machine, 0);
-	printf("%c", c);
-}
+	fprintf(stderr, "Warmed up in %llu cycles, cloning\n", (unsigned long long)machine->cycle);
 
-/**
- * The universal machine waits for input on the console.
- * When input arrives, the register C is loaded with the
- * input, which must be between and including 0 and 255.
- * If the end of input has been signaled, then the
- * register C is endowed with a uniform value pattern
- * where every place is pregnant with the 1 bit.
- */
+	int running = 0;
+	int failed = 0;
+	int status;
+	int i;
 
-void input(Operation* op, Machine* machine)
-{
-	char c = getc(stdin);
-	set_register(op->standard.c, c == EOF ? 0xFFFFFFFF : c, machine, 0);
-}
+	for (i = 0; i < inputs_count; i++)
+	{
+		if (running == jobs)
+		{
+			wait(&status);
+			failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+			running--;
+		}
 
-/**
- * The array identified by the B register is duplicated
- * and the duplicate shall replace the '0' array,
- * regardless of size. The execution finger is placed
- * to indicate the platter of this array that is
- * described by the offset given in C, where the value
- * 0 denotes the first platter, 1 the second, et
- * cetera.
- *
- * The '0' array shall be the most sublime choice for
- * loading, and shall be handled with the utmost
- * velocity.
- */
+		pid_t pid = machine_fork(machine);
 
-void load_program(Operation* op, Machine* machine)
-{
-	uint32_t index = get_register(op->standard.b, machine, 0);
-	TRACE("loading program at array[%d] setting execution at offset %d\n", index, op->standard.c);
+		if (pid < 0)
+		{
+			fprintf(stderr, "FATAL: Can't fork a clone: %d\n", errno);
+			exit(ERR_OUT_OF_MEMORY);
+		}
 
-	if (index)
-	{
-		TRACE("loading program from non 0 array, copying from %d into 0\n", index);
+		if (pid > 0)
+		{
+			running++;
+			continue;
+		}
 
-		Array* src = get_array(index, machine);
+		char output_filename[PATH_MAX];
+		snprintf(output_filename, sizeof(output_filename), "%s.out", inputs[i]);
 
-		#ifndef UNSAFE
-		if (src->content == NULL)
+		if (freopen(inputs[i], "rb", stdin) == NULL || freopen(output_filename, "wb", stdout) == NULL)
 		{
-			fprintf(stderr, "FATAL: loading program from an unallocated array %d.\n", index);
-			fatal(ERR_MEMORY_ACCESS_INVALID, machine);
+			fprintf(stderr, "ERROR: Can't open %s or %s\n", inputs[i], output_filename);
+			_exit(ERR_INVALID_PROGRAM_FILE);
 		}
-		#endif
 
-		allocate_memory(PROGRAM_ARRAY, src->size, machine);
+		MachineStatus result = machine_run(machine);
+
+		if (memory_report)
+			write_leak_report(machine, stderr);
 
-		Array* program = get_array(PROGRAM_ARRAY, machine);
-		memcpy(program->content, src->content, src->size * sizeof(uint32_t));
+		fflush(stdout);
+		_exit(result == MACHINE_HALTED ? 0 : ERR_PROGRAM_EXECUTION_ENDED_UNEXPECTEDLY);
 	}
 
-	set_register(PC_REGISTER, get_register(op->standard.c, machine, 0), machine, 1);
-}
+	while (running > 0)
+	{
+		wait(&status);
+		failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+		running--;
+	}
 
-/**
- * The value indicated is loaded into the register A
- * forthwith.
- */
+	if (failed)
+		fprintf(stderr, "%d of %d clones failed\n", failed, inputs_count);
+
+	return failed ? ERR_PROGRAM_EXECUTION_ENDED_UNEXPECTEDLY : 0;
+}
 
-void ortography(Operation* op, Machine* machine)
+void usage(const char* name)
 {
-	TRACE("Setting register r%d = %d\n", op->put.a, op->put.value);
-	set_register(op->put.a, op->put.value, machine, 0);
+	fprintf(stderr, "Usage: %s [-p profile] [-t trace] [-m limit] [-M] [-G threshold] [-C cache] [-s stats] [--perf-counters] [--debug[=script]] [--threads] [-R recording [-i interval]] (program_file | -S snapshot)\n", name);
+	fprintf(stderr, "       %s [-p profile] [-t trace] [-m limit] [-M] [-G threshold] [--perf-counters] -P recording [-c cycle]\n", name);
+	fprintf(stderr, "       %s [-m limit] [-M] [-G threshold] [-C cache] [-w warmup] [-j jobs] -f program_file input...\n", name);
+	exit(ERR_MISSING_ARGUMENTS);
 }
@@ -1,45 +1,153 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define HAS_SSSE3_SWAP
+#endif
 
 #include "operation.h"
 #include "error_codes.h"
 
-uint32_t operation_to_int(Operation* operation)
+static const char* operation_names[] = {
+	"cmove",
+	"get",
+	"set",
+	"add",
+	"mult",
+	"div",
+	"nand",
+	"halt",
+	"allocate",
+	"free",
+	"out",
+	"in",
+	"load",
+	"put"
+};
+
+/**
+ * Writes the decimal representation of value, without
+ * a terminator, and returns its length.
+ */
+
+size_t format_uint(uint32_t value, char* buffer)
 {
-	if (!operation)
-		return 0;
+	char digits[10];
+	size_t length = 0;
 
-	if (operation->standard.number < 13)
+	do
 	{
-		return operation->standard.number | (operation->standard.a << 23) | (operation->standard.b << 26) | (operation->standard.c << 29);
+		digits[length++] = '0' + (value % 10);
+		value /= 10;
 	}
-	else if (operation->put.number == 13)
+	while (value);
+
+	size_t i;
+	for (i = 0; i < length; i++)
+		buffer[i] = digits[length - i - 1];
+
+	return length;
+}
+
+/**
+ * Writes the assembly line for platter, newline included
+ * but without a terminator, and returns its length. At most
+ * MAX_SOURCE_LINE bytes are written.
+ */
+
+size_t operation_to_source(uint32_t platter, char* buffer)
+{
+	uint32_t number = operation_number(platter);
+	char* p = buffer;
+
+	if (number > 13)
+	{
+		static const char wrong[] = "# Wrong opcode detected: ";
+
+		memcpy(p, wrong, sizeof(wrong) - 1);
+		p += sizeof(wrong) - 1;
+		p += format_uint(number, p);
+		*p++ = '\n';
+
+		return p - buffer;
+	}
+
+	const char* name = operation_names[number];
+
+	while (*name)
+		*p++ = *name++;
+
+	*p++ = ' ';
+
+	if (number == 13)
 	{
-		return operation->put.number | (operation->put.a << 4) | (operation->put.value << 7);
+		*p++ = '0' + put_register(platter);
+		*p++ = ' ';
+		p += format_uint(put_value(platter), p);
 	}
 	else
 	{
-		fprintf(stderr, "FATAL: Invalid opcode passed to operation_to_int: %d\n", operation->standard.number);
-		exit(ERR_INVALID_OPCODE);
+		*p++ = '0' + operation_a(platter);
+		*p++ = ' ';
+		*p++ = '0' + operation_b(platter);
+		*p++ = ' ';
+		*p++ = '0' + operation_c(platter);
 	}
 
-	return 0;
+	*p++ = '\n';
+
+	return p - buffer;
 }
 
-void int_to_operation(uint32_t value, Operation* operation)
+#if defined(HAS_SSSE3_SWAP)
+
+/**
+ * Swaps four platters at a time. Built for SSSE3 whatever
+ * the flags of the build, and only called when the CPU
+ * running it supports it. Returns how many were swapped.
+ */
+
+__attribute__((target("ssse3")))
+static size_t platters_from_big_endian_ssse3(uint32_t* platters, const uint8_t* bytes, size_t count)
 {
-	operation->standard.number = (value >> 28) & 0xF;
+	const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	size_t i;
 
-	if (operation->standard.number < 13)
+	for (i = 0; i + 4 <= count; i += 4)
 	{
-		operation->standard.a = (value >> 6) & 7;
-		operation->standard.b = (value >> 3) & 7;
-		operation->standard.c = (value) & 7;
+		__m128i block = _mm_loadu_si128((const __m128i*)(bytes + i * sizeof(uint32_t)));
+		_mm_storeu_si128((__m128i*)(platters + i), _mm_shuffle_epi8(block, mask));
 	}
-	else
+
+	return i;
+}
+
+#endif
+
+/**
+ * Converts count big-endian platters into host order,
+ * four at a time when the CPU supports SSSE3.
+ */
+
+void platters_from_big_endian(uint32_t* platters, const uint8_t* bytes, size_t count)
+{
+	size_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	memcpy(platters, bytes, count * sizeof(uint32_t));
+	return;
+#elif defined(HAS_SSSE3_SWAP)
+	if (__builtin_cpu_supports("ssse3"))
+		i = platters_from_big_endian_ssse3(platters, bytes, count);
+#endif
+
+	for (; i < count; i++)
 	{
-		operation->put.a = (value >> 25) & 7;
-		operation->put.value = value & 0x1FFFFFF;
+		uint32_t value;
+		memcpy(&value, bytes + i * sizeof(uint32_t), sizeof(uint32_t));
+		platters[i] = __builtin_bswap32(value);
 	}
 }
@@ -1,26 +1,67 @@
 #if !defined(__OPERATION_H)
 #define __OPERATION_H
 
-typedef struct StandardOperation {
-	uint8_t number: 4;
-	uint32_t      : 17;
-	uint8_t a     : 3;
-	uint8_t b     : 3;
-	uint8_t c     : 3;
-} StandardOperation;
-
-typedef struct PutOperation {
-	uint8_t number: 4;
-	uint8_t a     : 3;
-	uint32_t value: 25;
-} PutOperation;
-
-typedef union Operation {
-	StandardOperation standard;
-	PutOperation put;
-} Operation;
-
-uint32_t operation_to_int(Operation* operation);
-void int_to_operation(uint32_t value, Operation* operation);
+#include <stddef.h>
+#include <stdint.h>
+
+#define OPERATION_OUTPUT 10
+#define OPERATION_ORTHOGRAPHY 13
+#define PUT_VALUE_MASK 0x1FFFFFF
+
+/**
+ * Operations are decoded straight from the platter. The
+ * operator number is held by the four most significant
+ * bits and the registers A, B and C of a standard operator
+ * by the nine least significant ones. The orthography
+ * operator keeps its register in the three bits after the
+ * number and its value in the remaining twenty-five.
+ */
+
+static inline uint32_t operation_number(uint32_t platter)
+{
+	return platter >> 28;
+}
+
+static inline uint32_t operation_a(uint32_t platter)
+{
+	return (platter >> 6) & 7;
+}
+
+static inline uint32_t operation_b(uint32_t platter)
+{
+	return (platter >> 3) & 7;
+}
+
+static inline uint32_t operation_c(uint32_t platter)
+{
+	return platter & 7;
+}
+
+static inline uint32_t put_register(uint32_t platter)
+{
+	return (platter >> 25) & 7;
+}
+
+static inline uint32_t put_value(uint32_t platter)
+{
+	return platter & PUT_VALUE_MASK;
+}
+
+static inline uint32_t encode_standard(uint32_t number, uint32_t a, uint32_t b, uint32_t c)
+{
+	return (number << 28) | ((a & 7) << 6) | ((b & 7) << 3) | (c & 7);
+}
+
+static inline uint32_t encode_put(uint32_t a, uint32_t value)
+{
+	return ((uint32_t)OPERATION_ORTHOGRAPHY << 28) | ((a & 7) << 25) | (value & PUT_VALUE_MASK);
+}
+
+// Longest line produced by operation_to_source
+#define MAX_SOURCE_LINE 32
+
+size_t format_uint(uint32_t value, char* buffer);
+size_t operation_to_source(uint32_t platter, char* buffer);
+void platters_from_big_endian(uint32_t* platters, const uint8_t* bytes, size_t count);
 
 #endif //__OPERATION_H
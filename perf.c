@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+#define CPU_CYCLES 0
+#define INSTRUCTIONS 1
+
+static const uint64_t events[PERF_COUNTERS_COUNT] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_MISSES
+};
+
+static const char* names[PERF_COUNTERS_COUNT] = {
+	"cpu cycles",
+	"instructions",
+	"branch misses",
+	"LLC misses"
+};
+
+/**
+ * Opens the counters disabled, so that only what happens
+ * between perf_start and perf_stop is counted. Returns how
+ * many of them are available.
+ */
+
+int perf_open(PerfCounters* counters)
+{
+	int available = 0;
+	int i;
+
+	memset(counters, 0, sizeof(PerfCounters));
+
+	for (i = 0; i < PERF_COUNTERS_COUNT; i++)
+	{
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(struct perf_event_attr));
+		attr.size = sizeof(struct perf_event_attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = events[i];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		counters->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+		if (counters->fds[i] >= 0)
+			available++;
+	}
+
+	return available;
+}
+
+void perf_start(PerfCounters* counters)
+{
+	int i;
+	for (i = 0; i < PERF_COUNTERS_COUNT; i++)
+	{
+		if (counters->fds[i] >= 0)
+		{
+			ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+void perf_stop(PerfCounters* counters)
+{
+	int i;
+	for (i = 0; i < PERF_COUNTERS_COUNT; i++)
+	{
+		if (counters->fds[i] >= 0)
+		{
+			ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+			if (read(counters->fds[i], &counters->values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+				counters->values[i] = 0;
+		}
+	}
+}
+
+/**
+ * Prints every counter along with its rate per executed
+ * UM instruction, so that changes to the dispatch can be
+ * compared on the same program.
+ */
+
+void perf_write(PerfCounters* counters, uint64_t um_cycles, FILE* out)
+{
+	fprintf(out, "[um] cycle %llu: hardware counters\n", (unsigned long long)um_cycles);
+
+	int i;
+	for (i = 0; i < PERF_COUNTERS_COUNT; i++)
+	{
+		if (counters->fds[i] < 0)
+		{
+			fprintf(out, "[um]   %-14s not supported\n", names[i]);
+			continue;
+		}
+
+		fprintf(out, "[um]   %-14s %15llu (%.3f per UM instruction)\n",
+			names[i],
+			(unsigned long long)counters->values[i],
+			um_cycles ? (double)counters->values[i] / um_cycles : 0.0
+		);
+	}
+
+	if (counters->fds[CPU_CYCLES] >= 0 && counters->fds[INSTRUCTIONS] >= 0 && counters->values[CPU_CYCLES])
+	{
+		fprintf(out, "[um]   %-14s %15.2f\n", "IPC",
+			(double)counters->values[INSTRUCTIONS] / counters->values[CPU_CYCLES]);
+	}
+}
+
+void perf_close(PerfCounters* counters)
+{
+	int i;
+	for (i = 0; i < PERF_COUNTERS_COUNT; i++)
+	{
+		if (counters->fds[i] >= 0)
+			close(counters->fds[i]);
+
+		counters->fds[i] = -1;
+	}
+}
@@ -0,0 +1,26 @@
+#if !defined(__PERF_H)
+#define __PERF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PERF_COUNTERS_COUNT 4
+
+/**
+ * Hardware counters of the process, counted in user space
+ * only. A counter the CPU or the kernel doesn't provide
+ * keeps a -1 descriptor and is reported as such.
+ */
+
+typedef struct PerfCounters {
+	int		fds[PERF_COUNTERS_COUNT];
+	uint64_t	values[PERF_COUNTERS_COUNT];
+} PerfCounters;
+
+int perf_open(PerfCounters* counters);
+void perf_start(PerfCounters* counters);
+void perf_stop(PerfCounters* counters);
+void perf_write(PerfCounters* counters, uint64_t um_cycles, FILE* out);
+void perf_close(PerfCounters* counters);
+
+#endif /* __PERF_H */
@@ -0,0 +1,92 @@
+#if !defined(__SPECIALIZED_H)
+#define __SPECIALIZED_H
+
+/**
+ * Handlers of the seven operators reading three registers,
+ * generated for every combination of registers so that
+ * none of them is extracted from the platter at run time,
+ * and of put for every register. They behave exactly like
+ * the generic handlers, and are only included by machine.c
+ * when built with SPECIALIZED_HANDLERS.
+ */
+
+#define R(i) (machine->registers[i])
+
+#define EACH_C(F, name, a, b) \
+	F(name, a, b, 0) F(name, a, b, 1) F(name, a, b, 2) F(name, a, b, 3) \
+	F(name, a, b, 4) F(name, a, b, 5) F(name, a, b, 6) F(name, a, b, 7)
+
+#define EACH_B(F, name, a) \
+	EACH_C(F, name, a, 0) EACH_C(F, name, a, 1) EACH_C(F, name, a, 2) EACH_C(F, name, a, 3) \
+	EACH_C(F, name, a, 4) EACH_C(F, name, a, 5) EACH_C(F, name, a, 6) EACH_C(F, name, a, 7)
+
+#define EACH_A(F, name) \
+	EACH_B(F, name, 0) EACH_B(F, name, 1) EACH_B(F, name, 2) EACH_B(F, name, 3) \
+	EACH_B(F, name, 4) EACH_B(F, name, 5) EACH_B(F, name, 6) EACH_B(F, name, 7)
+
+#define BODY_conditional_move(a, b, c) \
+	if (R(c)) \
+		R(a) = R(b);
+
+#define BODY_array_index(a, b, c) \
+	R(a) = read_array(R(b), R(c), machine);
+
+#define BODY_array_amendment(a, b, c) \
+	write_array(R(a), R(b), R(c), machine);
+
+#define BODY_addition(a, b, c) \
+	R(a) = R(b) + R(c);
+
+#define BODY_multiplication(a, b, c) \
+	R(a) = R(b) * R(c);
+
+#define BODY_division(a, b, c) \
+	if (R(c) == 0) \
+	{ \
+		fprintf(stderr, "FATAL: division by zero\n"); \
+		fatal(ERR_DIVISION_BY_ZERO, machine); \
+	} \
+	R(a) = R(b) / R(c);
+
+#define BODY_not_and(a, b, c) \
+	R(a) = ~(R(b) & R(c));
+
+#define DEFINE_HANDLER(name, a, b, c) \
+	static void name##_##a##b##c(uint32_t op, Machine* machine) { BODY_##name(a, b, c) }
+
+#define LIST_HANDLER(name, a, b, c) name##_##a##b##c,
+
+#define DEFINE_PUT_HANDLER(a) \
+	static void ortography_##a(uint32_t op, Machine* machine) { R(a) = put_value(op); }
+
+EACH_A(DEFINE_HANDLER, conditional_move)
+EACH_A(DEFINE_HANDLER, array_index)
+EACH_A(DEFINE_HANDLER, array_amendment)
+EACH_A(DEFINE_HANDLER, addition)
+EACH_A(DEFINE_HANDLER, multiplication)
+EACH_A(DEFINE_HANDLER, division)
+EACH_A(DEFINE_HANDLER, not_and)
+
+DEFINE_PUT_HANDLER(0)
+DEFINE_PUT_HANDLER(1)
+DEFINE_PUT_HANDLER(2)
+DEFINE_PUT_HANDLER(3)
+DEFINE_PUT_HANDLER(4)
+DEFINE_PUT_HANDLER(5)
+DEFINE_PUT_HANDLER(6)
+DEFINE_PUT_HANDLER(7)
+
+// In the order decode_instruction computes their indices
+
+#define SPECIALIZED_HANDLERS_TABLE \
+	EACH_A(LIST_HANDLER, conditional_move) \
+	EACH_A(LIST_HANDLER, array_index) \
+	EACH_A(LIST_HANDLER, array_amendment) \
+	EACH_A(LIST_HANDLER, addition) \
+	EACH_A(LIST_HANDLER, multiplication) \
+	EACH_A(LIST_HANDLER, division) \
+	EACH_A(LIST_HANDLER, not_and) \
+	ortography_0, ortography_1, ortography_2, ortography_3, \
+	ortography_4, ortography_5, ortography_6, ortography_7
+
+#endif /* __SPECIALIZED_H */
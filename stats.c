@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+#define NANOSECONDS 1000000000ULL
+#define READ_ATTEMPTS 1000
+
+uint64_t stats_now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (uint64_t)time.tv_sec * NANOSECONDS + time.tv_nsec;
+}
+
+/**
+ * Creates the file holding the counters and maps it,
+ * returning NULL if it can't be.
+ */
+
+Stats* stats_open(const char* filename)
+{
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, sizeof(Stats)) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	Stats* stats = (Stats*)mmap(NULL, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (stats == MAP_FAILED)
+		return NULL;
+
+	memcpy(stats->magic, STATS_MAGIC, 4);
+	stats->version = STATS_VERSION;
+	stats->pid = getpid();
+	stats->started = stats_now();
+	stats->updated = stats->started;
+
+	return stats;
+}
+
+/**
+ * Publishes the counters of the machine. The rate is the
+ * one measured since the previous update.
+ */
+
+void stats_update(Stats* stats, Machine* machine)
+{
+	uint64_t now = stats_now();
+	uint64_t sequence = atomic_load_explicit(&stats->sequence, memory_order_relaxed);
+
+	atomic_store_explicit(&stats->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	if (now > stats->updated)
+		stats->instructions_per_second = (machine->cycle - stats->cycle) * NANOSECONDS / (now - stats->updated);
+
+	stats->updated = now;
+	stats->cycle = machine->cycle;
+	stats->pc = machine->registers[PC_REGISTER];
+	stats->status = machine->status;
+	stats->live_arrays = machine->memory->live_arrays;
+	stats->live_bytes = machine->memory->live_bytes;
+	stats->peak_bytes = machine->memory->peak_bytes;
+	stats->bytes_in = machine->bytes_in;
+	stats->bytes_out = machine->bytes_out;
+
+	atomic_store_explicit(&stats->sequence, sequence + 2, memory_order_release);
+}
+
+/**
+ * Copies consistent counters out of a mapping updated by
+ * another process. Returns 0 if the machine kept updating
+ * them while reading.
+ */
+
+int stats_read(const Stats* stats, Stats* copy)
+{
+	int attempt;
+
+	for (attempt = 0; attempt < READ_ATTEMPTS; attempt++)
+	{
+		uint64_t before = atomic_load_explicit((_Atomic uint64_t*)&stats->sequence, memory_order_acquire);
+
+		if (before & 1)
+			continue;
+
+		memcpy(copy, (const void*)stats, sizeof(Stats));
+		atomic_thread_fence(memory_order_acquire);
+
+		if (atomic_load_explicit((_Atomic uint64_t*)&stats->sequence, memory_order_relaxed) == before)
+			return 1;
+	}
+
+	return 0;
+}
+
+void stats_close(Stats* stats)
+{
+	munmap(stats, sizeof(Stats));
+}
@@ -0,0 +1,44 @@
+#if !defined(__STATS_H)
+#define __STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "machine.h"
+
+#define STATS_MAGIC "UMST"
+#define STATS_VERSION 1
+
+/**
+ * The counters of a running machine, in a file mapped by
+ * the machine and by the tools polling it. The machine
+ * updates them on its event tick, making sequence odd
+ * while it writes, so that readers retry instead of
+ * seeing a partial update.
+ */
+
+typedef struct Stats {
+	char			magic[4];
+	uint32_t		version;
+	_Atomic uint64_t	sequence;
+	uint64_t		pid;
+	uint64_t		started;
+	uint64_t		updated;
+	uint64_t		cycle;
+	uint64_t		instructions_per_second;
+	uint64_t		pc;
+	uint64_t		status;
+	uint64_t		live_arrays;
+	uint64_t		live_bytes;
+	uint64_t		peak_bytes;
+	uint64_t		bytes_in;
+	uint64_t		bytes_out;
+} Stats;
+
+uint64_t stats_now(void);
+Stats* stats_open(const char* filename);
+void stats_update(Stats* stats, Machine* machine);
+int stats_read(const Stats* stats, Stats* copy);
+void stats_close(Stats* stats);
+
+#endif /* __STATS_H */
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error_codes.h"
+#include "threads.h"
+
+static void spawn(uint32_t op, Machine* machine);
+static void join(uint32_t op, Machine* machine);
+static void compare_and_swap(uint32_t op, Machine* machine);
+static void* run_thread(void* argument);
+
+/**
+ * Makes the machine speak the threaded dialect: operators
+ * 14 and 15, invalid otherwise, spawn machines sharing its
+ * memory, join them and compare and swap platters.
+ */
+
+void threads_enable(Machine* machine)
+{
+	Threads* threads = (Threads*)calloc(1, sizeof(Threads));
+
+	if (threads == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating threads\n");
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	pthread_mutex_init(&threads->lock, NULL);
+	pthread_cond_init(&threads->halted, NULL);
+
+	share_memory(machine);
+
+	machine->extension = threads;
+	machine->extended_operation = threads_operation;
+}
+
+void threads_operation(uint32_t op, Machine* machine)
+{
+	if (operation_number(op) == OPERATION_SPAWN)
+		spawn(op, machine);
+	else if (op & COMPARE_AND_SWAP_FLAG)
+		compare_and_swap(op, machine);
+	else
+		join(op, machine);
+}
+
+/**
+ * A new machine starts executing the '0' array from the
+ * platter given by the register C, in its own thread and
+ * with a copy of the registers. It shares every array,
+ * the decoded '0' array included. Its identifier, which
+ * is never 0, is placed in the register A.
+ */
+
+static void spawn(uint32_t op, Machine* machine)
+{
+	Threads* threads = (Threads*)machine->extension;
+	Thread* thread = (Thread*)calloc(1, sizeof(Thread));
+
+	if (thread == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating a thread\n");
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+
+	Machine* spawned = &thread->machine;
+
+	memcpy(spawned->registers, machine->registers, sizeof(machine->registers));
+	spawned->registers[PC_REGISTER] = get_register(operation_c(op), machine, 0);
+	spawned->memory = machine->memory;
+	spawned->status = MACHINE_RUNNING;
+	spawned->next_event = EVENTS_POLL_INTERVAL;
+	spawned->read_byte = machine->read_byte;
+	spawned->write_byte = machine->write_byte;
+	spawned->extended_operation = machine->extended_operation;
+	spawned->extension = machine->extension;
+
+	// Borrowed: the '0' array can't be replaced while
+	// other machines are running
+
+	spawned->code = machine->code;
+	spawned->code_size = machine->code_size;
+	spawned->output_runs = machine->output_runs;
+	spawned->output_runs_count = machine->output_runs_count;
+	spawned->output_bytes = machine->output_bytes;
+
+	pthread_mutex_lock(&threads->lock);
+
+	uint32_t slot;
+	for (slot = 0; slot < threads->size && threads->threads[slot] != NULL; slot++);
+
+	if (slot == threads->size)
+	{
+		threads->threads = (Thread**)realloc(threads->threads, (threads->size + 1) * sizeof(Thread*));
+
+		if (threads->threads == NULL)
+		{
+			fprintf(stderr, "FATAL: Error allocating %u threads\n", threads->size + 1);
+			fatal(ERR_OUT_OF_MEMORY, machine);
+		}
+
+		threads->size++;
+	}
+
+	threads->threads[slot] = thread;
+
+	pthread_mutex_lock(&machine->memory->lock);
+	machine->memory->machines++;
+	pthread_mutex_unlock(&machine->memory->lock);
+
+	if (pthread_create(&thread->handle, NULL, run_thread, thread) != 0)
+	{
+		fprintf(stderr, "FATAL: Error creating the thread of machine %u\n", slot + 1);
+		fatal(ERR_OUT_OF_MEMORY, machine);
+	}
+
+	pthread_mutex_unlock(&threads->lock);
+
+	set_register(operation_a(op), slot + 1, machine, 0);
+}
+
+/**
+ * Waits for the machine whose identifier is in the
+ * register C to halt. Its input and output are then
+ * counted as the joining machine's.
+ */
+
+static void join(uint32_t op, Machine* machine)
+{
+	Threads* threads = (Threads*)machine->extension;
+	uint32_t id = get_register(operation_c(op), machine, 0);
+
+	pthread_mutex_lock(&threads->lock);
+
+	if (id == 0 || id > threads->size || threads->threads[id - 1] == NULL)
+	{
+		pthread_mutex_unlock(&threads->lock);
+		fprintf(stderr, "FATAL: joining machine %u, which is not running.\n", id);
+		fatal(ERR_INVALID_MACHINE, machine);
+	}
+
+	// Released right away, so that joining it twice fails
+
+	Thread* thread = threads->threads[id - 1];
+	threads->threads[id - 1] = NULL;
+
+	while (!thread->halted)
+		pthread_cond_wait(&threads->halted, &threads->lock);
+
+	pthread_mutex_unlock(&threads->lock);
+	pthread_join(thread->handle, NULL);
+
+	machine->bytes_in += thread->machine.bytes_in;
+	machine->bytes_out += thread->machine.bytes_out;
+
+	free(thread);
+}
+
+/**
+ * If the platter of the array in the register A at the
+ * offset in the register B holds the value of the
+ * register C, it is replaced with the value of the
+ * register D. Either way, the register C receives the
+ * value the platter held, all at once for the other
+ * machines.
+ */
+
+static void compare_and_swap(uint32_t op, Machine* machine)
+{
+	uint32_t value = compare_and_swap_array(
+		get_register(operation_a(op), machine, 0),
+		get_register(operation_b(op), machine, 0),
+		get_register(operation_c(op), machine, 0),
+		get_register(operation_d(op), machine, 0),
+		machine
+	);
+
+	set_register(operation_c(op), value, machine, 0);
+}
+
+static void* run_thread(void* argument)
+{
+	Thread* thread = (Thread*)argument;
+	Machine* machine = &thread->machine;
+	Threads* threads = (Threads*)machine->extension;
+
+	machine_run(machine);
+
+	pthread_mutex_lock(&machine->memory->lock);
+	machine->memory->machines--;
+	pthread_mutex_unlock(&machine->memory->lock);
+
+	pthread_mutex_lock(&threads->lock);
+	thread->halted = 1;
+	pthread_cond_broadcast(&threads->halted);
+	pthread_mutex_unlock(&threads->lock);
+
+	return NULL;
+}
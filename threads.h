@@ -0,0 +1,51 @@
+#if !defined(__THREADS_H)
+#define __THREADS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "machine.h"
+
+#define OPERATION_SPAWN 14
+#define OPERATION_JOIN 15
+
+// Turns a join into a compare and swap
+#define COMPARE_AND_SWAP_FLAG (1 << 12)
+
+/**
+ * The register holding the value swapped in by a compare
+ * and swap, in the bits following the register C.
+ */
+
+static inline uint32_t operation_d(uint32_t platter)
+{
+	return (platter >> 9) & 7;
+}
+
+/**
+ * A machine spawned in its own thread, until joined.
+ */
+
+typedef struct Thread {
+	pthread_t	handle;
+	Machine		machine;
+	int		halted;
+} Thread;
+
+/**
+ * The machines spawned by a program, identified by their
+ * index in threads plus one. A slot is reused once its
+ * machine was joined.
+ */
+
+typedef struct Threads {
+	pthread_mutex_t	lock;
+	pthread_cond_t	halted;
+	Thread**	threads;
+	uint32_t	size;
+} Threads;
+
+void threads_enable(Machine* machine);
+void threads_operation(uint32_t op, Machine* machine);
+
+#endif /* __THREADS_H */
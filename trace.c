@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <time.h>
+
+#include "error_codes.h"
+#include "trace.h"
+
+static void* trace_writer(void* data);
+
+/**
+ * Creates the trace file and starts the thread writing
+ * to it. Returns NULL if the file can't be created.
+ */
+
+TraceRing* trace_open(const char* filename, uint64_t first_cycle)
+{
+	FILE* out = fopen(filename, "wb");
+
+	if (out == NULL)
+		return NULL;
+
+	TraceRing* ring = (TraceRing*)calloc(1, sizeof(TraceRing));
+
+	if (ring == NULL || (ring->records = (TraceRecord*)calloc(TRACE_RING_RECORDS, sizeof(TraceRecord))) == NULL)
+	{
+		fprintf(stderr, "FATAL: Error allocating the trace buffer\n");
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	TraceHeader header;
+	memset(&header, 0, sizeof(TraceHeader));
+	memcpy(header.magic, TRACE_MAGIC, 4);
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(TraceRecord);
+	header.first_cycle = first_cycle;
+
+	fwrite(&header, sizeof(TraceHeader), 1, out);
+
+	ring->out = out;
+	atomic_init(&ring->published, 0);
+	atomic_init(&ring->consumed, 0);
+	atomic_init(&ring->stopping, 0);
+
+	if (pthread_create(&ring->writer, NULL, trace_writer, ring) != 0)
+	{
+		fprintf(stderr, "FATAL: Can't start the trace writer\n");
+		exit(ERR_OUT_OF_MEMORY);
+	}
+
+	return ring;
+}
+
+/**
+ * Publishes what's left in the ring and waits for the
+ * writer to drain it.
+ */
+
+void trace_close(TraceRing* ring)
+{
+	atomic_store_explicit(&ring->published, ring->head, memory_order_release);
+	atomic_store_explicit(&ring->stopping, 1, memory_order_release);
+	pthread_join(ring->writer, NULL);
+
+	fclose(ring->out);
+	free(ring->records);
+	free(ring);
+}
+
+/**
+ * Slow path of trace_push, taken when the ring looks full:
+ * makes everything visible to the writer and waits for it
+ * to free some space.
+ */
+
+void trace_wait(TraceRing* ring)
+{
+	atomic_store_explicit(&ring->published, ring->head, memory_order_release);
+
+	for (;;)
+	{
+		ring->consumed_cache = atomic_load_explicit(&ring->consumed, memory_order_acquire);
+
+		if (ring->head - ring->consumed_cache < TRACE_RING_RECORDS)
+			return;
+
+		sched_yield();
+	}
+}
+
+static void* trace_writer(void* data)
+{
+	TraceRing* ring = (TraceRing*)data;
+	struct timespec pause = { 0, 1000000 };
+	int failed = 0;
+
+	for (;;)
+	{
+		int stopping = atomic_load_explicit(&ring->stopping, memory_order_acquire);
+		uint32_t published = atomic_load_explicit(&ring->published, memory_order_acquire);
+		uint32_t consumed = atomic_load_explicit(&ring->consumed, memory_order_relaxed);
+
+		if (published == consumed)
+		{
+			if (stopping)
+				break;
+
+			nanosleep(&pause, NULL);
+			continue;
+		}
+
+		// At most two writes, when the pending records wrap around
+
+		while (consumed != published)
+		{
+			uint32_t start = consumed & (TRACE_RING_RECORDS - 1);
+			uint32_t count = published - consumed;
+
+			if (start + count > TRACE_RING_RECORDS)
+				count = TRACE_RING_RECORDS - start;
+
+			// On errors records are dropped rather than blocking the machine
+
+			if (!failed && fwrite(&ring->records[start], sizeof(TraceRecord), count, ring->out) != count)
+			{
+				fprintf(stderr, "ERROR: Error writing the trace, the rest of it will be lost\n");
+				failed = 1;
+			}
+
+			consumed += count;
+			atomic_store_explicit(&ring->consumed, consumed, memory_order_release);
+		}
+	}
+
+	return NULL;
+}
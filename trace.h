@@ -0,0 +1,88 @@
+#if !defined(__TRACE_H)
+#define __TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define TRACE_MAGIC "UMTR"
+#define TRACE_VERSION 1
+#define TRACE_NO_REGISTER 0xFF
+
+// Records are made visible to the writer in batches
+#define TRACE_BATCH 256
+#define TRACE_RING_RECORDS (1 << 20)
+
+/**
+ * One executed instruction: where it was, what it was and
+ * the register it wrote, if any, with its new value.
+ * Records are stored one per cycle after the header, so
+ * the cycle of a record is implied by its position.
+ */
+
+typedef struct TraceRecord {
+	uint32_t	pc;
+	uint32_t	platter;
+	uint32_t	value;
+	uint8_t		reg;
+	uint8_t		padding[3];
+} TraceRecord;
+
+typedef struct TraceHeader {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	record_size;
+	uint32_t	reserved;
+	uint64_t	first_cycle;
+} TraceHeader;
+
+/**
+ * A single producer, single consumer ring owned by the
+ * thread executing the machine and drained to disk by
+ * a background writer thread.
+ */
+
+typedef struct TraceRing {
+	TraceRecord*		records;
+	uint32_t		head;
+	uint32_t		consumed_cache;
+	_Atomic uint32_t	published;
+	_Atomic uint32_t	consumed;
+	_Atomic int		stopping;
+	pthread_t		writer;
+	FILE*			out;
+} TraceRing;
+
+TraceRing* trace_open(const char* filename, uint64_t first_cycle);
+void trace_close(TraceRing* ring);
+void trace_wait(TraceRing* ring);
+
+/**
+ * The last record pushed is only published along with the
+ * next one, so that it can still be completed or dropped
+ * by the producer.
+ */
+
+static inline void trace_push(TraceRing* ring, uint32_t pc, uint32_t platter, uint8_t reg, uint32_t value)
+{
+	if (ring->head - ring->consumed_cache == TRACE_RING_RECORDS)
+		trace_wait(ring);
+
+	if ((ring->head & (TRACE_BATCH - 1)) == 0)
+		atomic_store_explicit(&ring->published, ring->head, memory_order_release);
+
+	TraceRecord* record = &ring->records[ring->head & (TRACE_RING_RECORDS - 1)];
+	record->pc = pc;
+	record->platter = platter;
+	record->value = value;
+	record->reg = reg;
+
+	ring->head++;
+}
+
+static inline TraceRecord* trace_last(TraceRing* ring)
+{
+	return &ring->records[(ring->head - 1) & (TRACE_RING_RECORDS - 1)];
+}
+
+#endif /* __TRACE_H */
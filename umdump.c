@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "error_codes.h"
+#include "machine.h"
+
+#define DEFAULT_CONTEXT 8
+#define HEX_PER_LINE 8
+
+void usage(const char* name);
+void write_summary(Machine* machine);
+void write_listing(Machine* machine, uint32_t from, uint32_t to, uint32_t pc);
+void dump_array(Machine* machine, uint32_t index);
+
+/**
+ * Inspects a snapshot, most likely the memory dump written
+ * by a fatal error: registers, arrays and the disassembly
+ * of the '0' array around the execution finger.
+ */
+
+int main(int argc, char *argv[])
+{
+	uint32_t context = DEFAULT_CONTEXT;
+	int whole_program = 0;
+	int64_t array = -1;
+	int option;
+
+	while ((option = getopt(argc, argv, "dc:a:")) != -1)
+	{
+		switch(option)
+		{
+			case 'd':
+				whole_program = 1;
+				break;
+
+			case 'c':
+				context = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'a':
+				array = strtoul(optarg, NULL, 0);
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (argc - optind < 1)
+		usage(argv[0]);
+
+	FILE* in = fopen(argv[optind], "rb");
+
+	if (in == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't open snapshot file: %s\n", argv[optind]);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	Machine machine;
+	machine_init(&machine);
+	read_snapshot(in, &machine);
+	fclose(in);
+
+	if (array >= 0)
+	{
+		dump_array(&machine, (uint32_t)array);
+		return 0;
+	}
+
+	write_summary(&machine);
+
+	uint32_t pc = machine.registers[PC_REGISTER];
+	uint32_t size = machine.memory->arrays[PROGRAM_ARRAY].size;
+
+	if (whole_program)
+		write_listing(&machine, 0, size, pc);
+	else
+		write_listing(&machine, pc > context ? pc - context : 0, pc + context + 1 < size ? pc + context + 1 : size, pc);
+
+	machine_free(&machine);
+
+	return 0;
+}
+
+void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-d] [-c context] [-a array] snapshot\n", name);
+	exit(ERR_MISSING_ARGUMENTS);
+}
+
+void write_summary(Machine* machine)
+{
+	uint32_t live = 0;
+	uint64_t bytes = 0;
+	uint32_t largest = 0;
+	uint32_t i;
+
+	for (i = 0; i < machine->memory->size; i++)
+	{
+		Array* array = &machine->memory->arrays[i];
+
+		if (array->content == NULL)
+			continue;
+
+		live++;
+		bytes += (uint64_t)array->size * sizeof(uint32_t);
+
+		if (array->size > machine->memory->arrays[largest].size)
+			largest = i;
+	}
+
+	printf("cycle %llu, pc %08x\n", (unsigned long long)machine->cycle, machine->registers[PC_REGISTER]);
+
+	for (i = 0; i < REGISTERS_COUNT; i++)
+		printf("r%u = %08x (%u)\n", i, machine->registers[i], machine->registers[i]);
+
+	printf("%u arrays, %u live holding %llu bytes, %u identifiers to reuse\n",
+		machine->memory->size, live, (unsigned long long)bytes, machine->memory->pool_pointer);
+	printf("largest array %u: %u platters\n\n", largest, machine->memory->arrays[largest].size);
+}
+
+/**
+ * Disassembles platters from up to to of the '0' array,
+ * pointing at the one the execution finger is on. After a
+ * fatal error, that's the one after the failing operation.
+ */
+
+void write_listing(Machine* machine, uint32_t from, uint32_t to, uint32_t pc)
+{
+	Array* program = &machine->memory->arrays[PROGRAM_ARRAY];
+	char source[MAX_SOURCE_LINE + 1];
+	uint32_t i;
+
+	for (i = from; i < to; i++)
+	{
+		size_t length = operation_to_source(program->content[i], source);
+		source[length - 1] = '\0';
+
+		printf("%s %08x\t%08x\t%s\n", i == pc ? ">" : " ", i, program->content[i], source);
+	}
+}
+
+void dump_array(Machine* machine, uint32_t index)
+{
+	if (index >= machine->memory->size || machine->memory->arrays[index].content == NULL)
+	{
+		fprintf(stderr, "FATAL: array %u is not allocated\n", index);
+		exit(ERR_MEMORY_ACCESS_INVALID);
+	}
+
+	Array* array = &machine->memory->arrays[index];
+	uint32_t i;
+
+	for (i = 0; i < array->size; i++)
+	{
+		if (i % HEX_PER_LINE == 0)
+			printf("%08x:", i);
+
+		printf(" %08x", array->content[i]);
+
+		if (i % HEX_PER_LINE == HEX_PER_LINE - 1 || i == array->size - 1)
+			printf("\n");
+	}
+}
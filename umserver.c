@@ -0,0 +1,564 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "error_codes.h"
+#include "machine.h"
+
+#define DEFAULT_MAX_SESSIONS 64
+#define DEFAULT_SLICE (1 << 20)
+#define MAX_EVENTS 64
+#define INPUT_BUFFER_SIZE 4096
+#define OUTPUT_HIGH_WATER (1 << 16)
+#define OUTPUT_LOW_WATER (1 << 12)
+
+/**
+ * A connection and the machine serving it. The machine
+ * reads from in and writes to out, the event loop moving
+ * bytes between them and the socket. A session is in
+ * the run queue only while its machine can make progress.
+ */
+
+typedef struct Session Session;
+
+struct Session {
+	int		fd;
+	Machine		machine;
+	uint8_t		in[INPUT_BUFFER_SIZE];
+	uint32_t	in_start;
+	uint32_t	in_end;
+	int		in_closed;
+	uint8_t*	out;
+	uint32_t	out_start;
+	uint32_t	out_end;
+	uint32_t	out_capacity;
+	int		output_blocked;
+	int		queued;
+	int		finished;
+	uint32_t	interest;
+	Session*	next;
+};
+
+Session* run_queue_head = NULL;
+Session* run_queue_tail = NULL;
+
+int epoll_fd = -1;
+uint32_t sessions_count = 0;
+uint32_t max_sessions = DEFAULT_MAX_SESSIONS;
+uint32_t slice = DEFAULT_SLICE;
+uint64_t memory_limit = 0;
+
+uint32_t* program = NULL;
+uint32_t program_size = 0;
+
+void load_program_file(const char* filename);
+int open_socket(const char* path);
+void accept_session(int listen_fd);
+void close_session(Session* session);
+void enqueue(Session* session);
+Session* dequeue(void);
+void run_session(Session* session);
+void receive_input(Session* session);
+void send_output(Session* session);
+void update_interest(Session* session);
+int session_read_byte(Machine* machine);
+void session_write_byte(Machine* machine, uint8_t byte);
+void session_preempt(Machine* machine);
+
+int main(int argc, char *argv[])
+{
+	int option;
+
+	while ((option = getopt(argc, argv, "n:s:m:")) != -1)
+	{
+		switch(option)
+		{
+			case 'n':
+				max_sessions = strtoul(optarg, NULL, 10);
+				break;
+
+			case 's':
+				slice = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'm':
+				memory_limit = strtoull(optarg, NULL, 10);
+				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-n max_sessions] [-s slice] [-m limit] socket_path program_file\n", argv[0]);
+				exit(ERR_MISSING_ARGUMENTS);
+		}
+	}
+
+	if (argc - optind < 2 || slice == 0)
+	{
+		fprintf(stderr, "Usage: %s [-n max_sessions] [-s slice] [-m limit] socket_path program_file\n", argv[0]);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	load_program_file(argv[optind + 1]);
+
+	int listen_fd = open_socket(argv[optind]);
+	struct epoll_event events[MAX_EVENTS];
+
+	for (;;)
+	{
+		// Machines waiting to run mean the loop can't block
+
+		int count = epoll_wait(epoll_fd, events, MAX_EVENTS, run_queue_head != NULL ? 0 : -1);
+
+		if (count < 0 && errno != EINTR)
+		{
+			perror("epoll_wait");
+			exit(ERR_INVALID_PROGRAM_FILE);
+		}
+
+		int i;
+		for (i = 0; i < count; i++)
+		{
+			Session* session = (Session*)events[i].data.ptr;
+
+			if (session == NULL)
+			{
+				accept_session(listen_fd);
+				continue;
+			}
+
+			if (events[i].events & EPOLLERR)
+				session->in_closed = 1;
+
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				receive_input(session);
+
+			if (session->fd >= 0 && (events[i].events & EPOLLOUT))
+				send_output(session);
+
+			if (session->fd < 0)
+				close_session(session);
+		}
+
+		Session* session = dequeue();
+
+		if (session != NULL)
+			run_session(session);
+	}
+
+	return 0;
+}
+
+/**
+ * Reads the program once, every session starting from
+ * a copy of it.
+ */
+
+void load_program_file(const char* filename)
+{
+	FILE* program_file = fopen(filename, "rb");
+
+	if (program_file == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't open program file: %s\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	fseek(program_file, 0, SEEK_END);
+	uint32_t fsize = ftell(program_file);
+	fseek(program_file, 0, SEEK_SET);
+
+	if (fsize % sizeof(uint32_t) != 0)
+	{
+		fprintf(stderr, "FATAL: program file %s holds %u bytes, which is not a whole number of platters\n", filename, fsize);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	uint8_t* bytes = (uint8_t*)malloc(fsize + 1);
+	program_size = fsize / sizeof(uint32_t);
+	program = (uint32_t*)malloc(program_size * sizeof(uint32_t) + 1);
+
+	if (bytes == NULL || program == NULL || fread(bytes, 1, fsize, program_file) != fsize)
+	{
+		fprintf(stderr, "FATAL: Can't read program file: %s\n", filename);
+		exit(ERR_INVALID_PROGRAM_FILE);
+	}
+
+	fclose(program_file);
+
+	platters_from_big_endian(program, bytes, program_size);
+	free(bytes);
+}
+
+int open_socket(const char* path)
+{
+	struct sockaddr_un address;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "FATAL: Socket path too long: %s\n", path);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	unlink(path);
+
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0)
+	{
+		fprintf(stderr, "FATAL: Can't listen on %s: %s\n", path, strerror(errno));
+		exit(ERR_MISSING_ARGUMENTS);
+	}
+
+	epoll_fd = epoll_create1(0);
+
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0)
+	{
+		perror("epoll");
+		exit(ERR_MISSING_ARGUMENTS);
+	}
+
+	fprintf(stderr, "Serving on %s\n", path);
+
+	return listen_fd;
+}
+
+/**
+ * Every connection gets a fresh machine, isolated so
+ * that its failures only end its own session.
+ */
+
+void accept_session(int listen_fd)
+{
+	int fd;
+
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+	{
+		if (sessions_count >= max_sessions)
+		{
+			close(fd);
+			continue;
+		}
+
+		Session* session = (Session*)calloc(1, sizeof(Session));
+
+		if (session == NULL)
+		{
+			close(fd);
+			continue;
+		}
+
+		session->fd = fd;
+
+		machine_init(&session->machine);
+		machine_load_program(&session->machine, program, program_size);
+
+		session->machine.memory->limit = memory_limit;
+		session->machine.isolated = 1;
+		session->machine.context = session;
+		session->machine.read_byte = session_read_byte;
+		session->machine.write_byte = session_write_byte;
+		session->machine.on_event = session_preempt;
+
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.ptr = session;
+		session->interest = EPOLLIN;
+
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+		sessions_count++;
+		enqueue(session);
+	}
+}
+
+/**
+ * Sessions are freed only once out of the run queue,
+ * their fd being set to -1 as soon as they're done.
+ */
+
+void close_session(Session* session)
+{
+	if (session->fd >= 0)
+	{
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+		close(session->fd);
+		session->fd = -1;
+	}
+
+	if (session->queued)
+		return;
+
+	machine_free(&session->machine);
+	free(session->out);
+	free(session);
+
+	sessions_count--;
+}
+
+void enqueue(Session* session)
+{
+	if (session->queued)
+		return;
+
+	session->queued = 1;
+	session->next = NULL;
+
+	if (run_queue_tail != NULL)
+		run_queue_tail->next = session;
+	else
+		run_queue_head = session;
+
+	run_queue_tail = session;
+}
+
+Session* dequeue(void)
+{
+	Session* session = run_queue_head;
+
+	if (session == NULL)
+		return NULL;
+
+	run_queue_head = session->next;
+
+	if (run_queue_head == NULL)
+		run_queue_tail = NULL;
+
+	session->queued = 0;
+	return session;
+}
+
+/**
+ * Runs a machine for at most a slice of cycles, then
+ * decides where it goes next depending on why it stopped.
+ */
+
+void run_session(Session* session)
+{
+	if (session->fd < 0)
+	{
+		close_session(session);
+		return;
+	}
+
+	Machine* machine = &session->machine;
+	machine->next_event = machine->cycle + slice;
+
+	MachineStatus status = machine_run(machine);
+
+	if (status == MACHINE_HALTED || status == MACHINE_FAILED)
+		session->finished = 1;
+
+	send_output(session);
+
+	if (session->fd < 0)
+	{
+		close_session(session);
+		return;
+	}
+
+	if (status == MACHINE_PREEMPTED && !session->output_blocked)
+		enqueue(session);
+}
+
+void receive_input(Session* session)
+{
+	if (session->in_start == session->in_end)
+	{
+		session->in_start = 0;
+		session->in_end = 0;
+	}
+
+	while (!session->in_closed && session->in_end < INPUT_BUFFER_SIZE)
+	{
+		ssize_t count = read(session->fd, session->in + session->in_end, INPUT_BUFFER_SIZE - session->in_end);
+
+		if (count > 0)
+		{
+			session->in_end += count;
+		}
+		else if (count == 0)
+		{
+			session->in_closed = 1;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			break;
+		}
+		else if (errno != EINTR)
+		{
+			session->in_closed = 1;
+		}
+	}
+
+	if (!session->finished && session->machine.status == MACHINE_WAITING_INPUT)
+		enqueue(session);
+
+	update_interest(session);
+}
+
+/**
+ * Writes as much pending output as the socket takes. A
+ * machine stopped by a full buffer resumes once it has
+ * drained below OUTPUT_LOW_WATER, and a finished session
+ * is closed once everything has been sent.
+ */
+
+void send_output(Session* session)
+{
+	while (session->out_start < session->out_end)
+	{
+		ssize_t count = write(session->fd, session->out + session->out_start, session->out_end - session->out_start);
+
+		if (count > 0)
+		{
+			session->out_start += count;
+		}
+		else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			break;
+		}
+		else if (count < 0 && errno != EINTR)
+		{
+			// The peer is gone, nobody is left to serve
+
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+			close(session->fd);
+			session->fd = -1;
+			return;
+		}
+	}
+
+	if (session->out_start == session->out_end)
+	{
+		session->out_start = 0;
+		session->out_end = 0;
+
+		if (session->finished)
+		{
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+			close(session->fd);
+			session->fd = -1;
+			return;
+		}
+	}
+
+	if (session->output_blocked && session->out_end - session->out_start < OUTPUT_LOW_WATER)
+	{
+		session->output_blocked = 0;
+		enqueue(session);
+	}
+
+	update_interest(session);
+}
+
+/**
+ * Only asks for input when there's room for it, and for
+ * writability when there's something to write.
+ */
+
+void update_interest(Session* session)
+{
+	uint32_t interest = 0;
+
+	if (!session->in_closed && session->in_end < INPUT_BUFFER_SIZE)
+		interest |= EPOLLIN;
+
+	if (session->out_start < session->out_end)
+		interest |= EPOLLOUT;
+
+	if (interest == session->interest)
+		return;
+
+	struct epoll_event event;
+	event.events = interest;
+	event.data.ptr = session;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+	session->interest = interest;
+}
+
+int session_read_byte(Machine* machine)
+{
+	Session* session = (Session*)machine->context;
+
+	if (session->in_start < session->in_end)
+	{
+		uint8_t byte = session->in[session->in_start++];
+
+		if (session->in_end - session->in_start == INPUT_BUFFER_SIZE / 2)
+			update_interest(session);
+
+		return byte;
+	}
+
+	if (session->in_closed)
+		return EOF;
+
+	session->in_start = 0;
+	session->in_end = 0;
+	update_interest(session);
+
+	return MACHINE_WOULD_BLOCK;
+}
+
+/**
+ * The machine is stopped when its output piles up faster
+ * than the peer reads it.
+ */
+
+void session_write_byte(Machine* machine, uint8_t byte)
+{
+	Session* session = (Session*)machine->context;
+
+	if (session->out_end == session->out_capacity)
+	{
+		if (session->out_start > 0)
+		{
+			memmove(session->out, session->out + session->out_start, session->out_end - session->out_start);
+			session->out_end -= session->out_start;
+			session->out_start = 0;
+		}
+		else
+		{
+			session->out_capacity = session->out_capacity ? session->out_capacity * 2 : 4096;
+			session->out = (uint8_t*)realloc(session->out, session->out_capacity);
+
+			if (session->out == NULL)
+			{
+				fprintf(stderr, "FATAL: Out of memory for session output\n");
+				exit(ERR_OUT_OF_MEMORY);
+			}
+		}
+	}
+
+	session->out[session->out_end++] = byte;
+
+	if (session->out_end - session->out_start >= OUTPUT_HIGH_WATER && machine->status == MACHINE_RUNNING)
+	{
+		session->output_blocked = 1;
+		machine_stop(machine, MACHINE_PREEMPTED);
+	}
+}
+
+void session_preempt(Machine* machine)
+{
+	machine_stop(machine, MACHINE_PREEMPTED);
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stats.h"
+
+#define ERR_MISSING_ARGUMENTS 2
+#define ERR_INVALID_INPUT_FILE 3
+
+static const char* status_names[] = {
+	"running",
+	"halted",
+	"waiting input",
+	"preempted",
+	"failed",
+	"breakpoint"
+};
+
+void usage(const char* name);
+
+/**
+ * Polls the statistics of a running machine, written by
+ * um -s, printing a line every interval until the machine
+ * stops or count lines were printed.
+ */
+
+int main(int argc, char *argv[])
+{
+	double interval = 1;
+	long count = -1;
+	int option;
+
+	while ((option = getopt(argc, argv, "i:n:")) != -1)
+	{
+		switch(option)
+		{
+			case 'i':
+				interval = strtod(optarg, NULL);
+				break;
+
+			case 'n':
+				count = strtol(optarg, NULL, 10);
+				break;
+
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (argc - optind < 1 || interval <= 0)
+		usage(argv[0]);
+
+	int fd = open(argv[optind], O_RDONLY);
+	struct stat file_stat;
+	Stats* stats = MAP_FAILED;
+
+	// Mapping past the end of a shorter file would fault on access.
+
+	if (fd >= 0 && fstat(fd, &file_stat) == 0 && file_stat.st_size >= (off_t)sizeof(Stats))
+		stats = (Stats*)mmap(NULL, sizeof(Stats), PROT_READ, MAP_SHARED, fd, 0);
+
+	if (stats == MAP_FAILED || memcmp(stats->magic, STATS_MAGIC, 4) != 0 || stats->version != STATS_VERSION)
+	{
+		fprintf(stderr, "FATAL: %s is not a statistics file\n", argv[optind]);
+		exit(ERR_INVALID_INPUT_FILE);
+	}
+
+	close(fd);
+
+	printf("%8s %16s %12s %10s %10s %14s %12s %12s  %s\n",
+		"time", "cycle", "ips", "pc", "arrays", "live bytes", "bytes in", "bytes out", "status");
+
+	while (count--)
+	{
+		Stats copy;
+
+		if (!stats_read(stats, &copy))
+		{
+			fprintf(stderr, "ERROR: the statistics keep changing, retrying\n");
+			continue;
+		}
+
+		printf("%8.1f %16llu %12llu %10llx %10llu %14llu %12llu %12llu  %s\n",
+			(copy.updated - copy.started) / 1e9,
+			(unsigned long long)copy.cycle,
+			(unsigned long long)copy.instructions_per_second,
+			(unsigned long long)copy.pc,
+			(unsigned long long)copy.live_arrays,
+			(unsigned long long)copy.live_bytes,
+			(unsigned long long)copy.bytes_in,
+			(unsigned long long)copy.bytes_out,
+			copy.status < sizeof(status_names) / sizeof(status_names[0]) ? status_names[copy.status] : "unknown"
+		);
+
+		fflush(stdout);
+
+		if (copy.status != MACHINE_RUNNING)
+			break;
+
+		if (count)
+			usleep((useconds_t)(interval * 1e6));
+	}
+
+	return 0;
+}
+
+void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [-i interval] [-n count] stats\n", name);
+	exit(ERR_MISSING_ARGUMENTS);
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define ERR_MISSING_ARGUMENTS 2
+#define ERR_INVALID_INPUT_FILE 3
+
+#define ANY 0xFFFFFFFF
+#define RECORDS_BLOCK 4096
+
+#include "operation.h"
+#include "trace.h"
+
+void write_record(uint64_t cycle, TraceRecord* record);
+
+int main(int argc, char *argv[])
+{
+	uint64_t from = 0;
+	uint64_t to = UINT64_MAX;
+	uint32_t pc = ANY;
+	uint32_t opcode = ANY;
+	int option;
+
+	while ((option = getopt(argc, argv, "f:t:p:o:")) != -1)
+	{
+		switch(option)
+		{
+			case 'f':
+				from = strtoull(optarg, NULL, 0);
+				break;
+
+			case 't':
+				to = strtoull(optarg, NULL, 0);
+				break;
+
+			case 'p':
+				pc = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'o':
+				opcode = strtoul(optarg, NULL, 0);
+				break;
+
+			default:
+				fprintf(stderr, "Usage: %s [-f from_cycle] [-t to_cycle] [-p pc] [-o opcode] trace\n", argv[0]);
+				exit(ERR_MISSING_ARGUMENTS);
+		}
+	}
+
+	if (argc - optind < 1)
+	{
+		fprintf(stderr, "Usage: %s [-f from_cycle] [-t to_cycle] [-p pc] [-o opcode] trace\n", argv[0]);
+		exit(ERR_MISSING_ARGUMENTS);
+	}
+
+	FILE* trace_file = fopen(argv[optind], "rb");
+
+	if (trace_file == NULL)
+	{
+		fprintf(stderr, "FATAL: Can't open trace file: %s\n", argv[optind]);
+		exit(ERR_INVALID_INPUT_FILE);
+	}
+
+	TraceHeader header;
+
+	if (fread(&header, sizeof(TraceHeader), 1, trace_file) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) != 0
+		|| header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord))
+	{
+		fprintf(stderr, "FATAL: %s is not a valid trace\n", argv[optind]);
+		exit(ERR_INVALID_INPUT_FILE);
+	}
+
+	uint64_t cycle = header.first_cycle;
+
+	if (from > cycle)
+	{
+		fseek(trace_file, (from - cycle) * sizeof(TraceRecord), SEEK_CUR);
+		cycle = from;
+	}
+
+	TraceRecord records[RECORDS_BLOCK];
+	size_t count;
+
+	while (cycle <= to && (count = fread(records, sizeof(TraceRecord), RECORDS_BLOCK, trace_file)) > 0)
+	{
+		size_t i;
+		for (i = 0; i < count && cycle <= to; i++, cycle++)
+		{
+			if (pc != ANY && records[i].pc != pc)
+				continue;
+
+			if (opcode != ANY && (records[i].platter >> 28) != opcode)
+				continue;
+
+			write_record(cycle, &records[i]);
+		}
+	}
+
+	fclose(trace_file);
+}
+
+/**
+ * Prints a record as: cycle, pc, disassembly and the
+ * register written.
+ */
+
+void write_record(uint64_t cycle, TraceRecord* record)
+{
+	char source[MAX_SOURCE_LINE + 1];
+	size_t length = operation_to_source(record->platter, source);
+	source[length - 1] = '\0';
+
+	if (record->reg == TRACE_NO_REGISTER)
+		printf("%llu\t%08x\t%s\n", (unsigned long long)cycle, record->pc, source);
+	else
+		printf("%llu\t%08x\t%-20s; r%u = %u\n", (unsigned long long)cycle, record->pc, source, record->reg, record->value);
+}